@@ -0,0 +1,160 @@
+// Alphabet partition tree, the wavelet coding mode (VLI_FLAG_WAVELET)
+// Symbol by symbol coding places each symbol among the locations the symbols before it left,
+// a chain as long as the alphabet.  The tree splits the block's symbols (used table entries, in
+// frequency table order) into two halves instead, codes which of the node's locations hold the
+// first half as a single combination, and recurses into each half with only its own locations.
+// A node of n locations, k of them in its first half, has n choose k possible values, and the
+// product over all nodes is the same multinomial as the symbol by symbol radices, so the encoded
+// size doesn't change.  The depth is log2 of the used symbols instead of their number, the two
+// halves of a node don't depend on each other, and every node's numbers are smaller.
+// Each node is a digit of the same mixed radix number (ProductTree, NativeKernel), the kernels
+// rank and unrank them like symbols.  Nodes are numbered in pre-order, node 0 is the root.
+// The locations of a node are kept in one buffer per tree level: a node's locations are a slice
+// of its level's buffer, its first half the start of that slice in the next level's buffer and
+// its second half the rest, so a node is one stable partition and siblings never overlap.
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct AlphabetTree {
+    struct Node {
+        // used table entries [first, last) of the node, [first, middle) are its first half
+        size_t first, middle, last;
+        // the node's locations and how many of them hold its first half
+        uint64_t locations, left_locations;
+        // start of the node's slice in its level's buffer, and the level
+        uint64_t offset;
+        size_t depth;
+    };
+    // internal nodes in pre-order, a single entry is a leaf and has no node
+    std::vector<Node> nodes;
+
+    // counts of the used table entries, in table order (ascending)
+    void build(const std::vector<uint64_t>& counts) {
+        nodes.clear();
+        if(counts.size() > 1) {
+            uint64_t total = 0;
+            for(uint64_t count : counts) {
+                total += count;
+            }
+            buildNode(counts, 0, counts.size(), total, 0, 0);
+        }
+    }
+
+    // Encoder: entries holds the entry (index among the used entries) of every location.
+    // locs receives, for node i from loc_start[i], the indexes among the node's locations of the
+    // ones holding its first half, ascending.  entries is used as the root level's buffer.
+    void partition(std::vector<uint32_t>& entries, std::vector<uint32_t>& scratch, std::vector<size_t>& locs, const std::vector<size_t>& loc_start) {
+        scratch.resize(entries.size());
+        std::vector<uint32_t>* levels[2] = {&entries, &scratch};
+        for(size_t node_idx = 0; node_idx < nodes.size(); node_idx++) {
+            Node& node = nodes[node_idx];
+            const uint32_t* in = levels[node.depth & 1]->data() + node.offset;
+            uint32_t* left = levels[(node.depth + 1) & 1]->data() + node.offset;
+            uint32_t* right = left + node.left_locations;
+            size_t* node_locs = &locs[loc_start[node_idx]];
+            for(uint64_t i = 0; i < node.locations; i++) {
+                uint32_t entry = in[i];
+                if(entry < node.middle) {
+                    *node_locs++ = i;
+                    *left++ = entry;
+                } else {
+                    *right++ = entry;
+                }
+            }
+        }
+    }
+
+    // Decoder: inverse of partition.  Calls leaf(entry, locations, count) with the block locations
+    // of every used entry, positions and scratch are the level buffers.
+    template<typename Leaf>
+    void place(const std::vector<size_t>& locs, const std::vector<size_t>& loc_start, uint64_t total_locations,
+               std::vector<size_t>& positions, std::vector<size_t>& scratch, Leaf leaf) {
+        positions.resize(total_locations);
+        scratch.resize(total_locations);
+        for(uint64_t i = 0; i < total_locations; i++) {
+            positions[i] = i;
+        }
+        std::vector<size_t>* levels[2] = {&positions, &scratch};
+        for(size_t node_idx = 0; node_idx < nodes.size(); node_idx++) {
+            Node& node = nodes[node_idx];
+            const size_t* in = levels[node.depth & 1]->data() + node.offset;
+            size_t* left = levels[(node.depth + 1) & 1]->data() + node.offset;
+            size_t* right = left + node.left_locations;
+            splitLocations(in, node.locations, &locs[loc_start[node_idx]], node.left_locations, left, right);
+            // halves of a single entry are leaves
+            if(node.middle - node.first == 1) {
+                leaf(node.first, left, node.left_locations);
+            }
+            if(node.last - node.middle == 1) {
+                leaf(node.middle, right, node.locations - node.left_locations);
+            }
+        }
+    }
+
+    // Decoder, one entry only: positions receives its block locations, ascending, following the
+    // path from the root and splitting only the nodes on it (all of them for a single symbol).
+    void locate(const std::vector<size_t>& locs, const std::vector<size_t>& loc_start, uint64_t total_locations, size_t entry,
+                std::vector<size_t>& positions, std::vector<size_t>& scratch) {
+        positions.resize(total_locations);
+        scratch.resize(total_locations);
+        for(uint64_t i = 0; i < total_locations; i++) {
+            positions[i] = i;
+        }
+        size_t node_idx = 0;
+        while(node_idx < nodes.size()) {
+            Node& node = nodes[node_idx];
+            // the current locations are the start of positions, split into scratch and keep one half
+            splitLocations(positions.data(), node.locations, &locs[loc_start[node_idx]], node.left_locations, scratch.data(), scratch.data() + node.left_locations);
+            if(entry < node.middle) {
+                positions.assign(scratch.begin(), scratch.begin() + node.left_locations);
+                // the left child is next in pre-order, unless the half is a leaf
+                node_idx = node.middle - node.first > 1 ? node_idx + 1 : nodes.size();
+            } else {
+                positions.assign(scratch.begin() + node.left_locations, scratch.begin() + node.locations);
+                node_idx = node.last - node.middle > 1 ? rightChild(node_idx) : nodes.size();
+            }
+        }
+    }
+
+  private:
+    void buildNode(const std::vector<uint64_t>& counts, size_t first, size_t last, uint64_t locations, uint64_t offset, size_t depth) {
+        size_t middle = first + (last - first) / 2;
+        uint64_t left_locations = 0;
+        for(size_t entry = first; entry < middle; entry++) {
+            left_locations += counts[entry];
+        }
+        nodes.push_back({first, middle, last, locations, left_locations, offset, depth});
+        if(middle - first > 1) {
+            buildNode(counts, first, middle, left_locations, offset, depth + 1);
+        }
+        if(last - middle > 1) {
+            buildNode(counts, middle, last, locations - left_locations, offset + left_locations, depth + 1);
+        }
+    }
+
+    // pre-order index of a node's right child, after the whole left subtree
+    size_t rightChild(size_t node_idx) {
+        Node& node = nodes[node_idx];
+        // a subtree of e entries has e-1 nodes
+        return node_idx + 1 + (node.middle - node.first - 1);
+    }
+
+    // in holds a node's count locations, the ones at the ascending indexes left_locs go to left,
+    // the others to right, both keep their order
+    static void splitLocations(const size_t* in, uint64_t count, const size_t* left_locs, uint64_t left_count, size_t* left, size_t* right) {
+        uint64_t i = 0;
+        for(uint64_t j = 0; j < left_count; j++) {
+            size_t next = left_locs[j];
+            for(; i < next; i++) {
+                *right++ = in[i];
+            }
+            *left++ = in[i++];
+        }
+        for(; i < count; i++) {
+            *right++ = in[i];
+        }
+    }
+};
@@ -0,0 +1,194 @@
+// Binomial coefficients from prime factorizations
+// n choose k is built from the exponent of every prime in n!/(k!(n-k)!) (Legendre's formula),
+// the prime powers are packed into machine words and multiplied with a balanced product tree.
+// There are no large divisions, unlike the falling factorial / k! approach.
+// The primes are sieved once and grown as larger blocks need them, and recently computed
+// coefficients are cached, both are shared by the whole process (encoder and decoder).
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>    // upper_bound, min, max
+#include <gmp.h>        // mpz_t
+
+#include "gmp-arena.hpp"
+#include "trace.hpp"
+
+// result = words[lo] * words[lo+1] * ... * words[hi-1], balanced so GMP multiplies similar sizes
+inline void product_of_words(mpz_t result, std::vector<uint64_t>& words, size_t lo, size_t hi) {
+    if(hi - lo <= 16) {
+        mpz_set_ui(result, 1);
+        for(size_t i = lo; i < hi; i++) {
+            mpz_mul_ui(result, result, words[i]);
+        }
+        return;
+    }
+    size_t mid = lo + (hi - lo)/2;
+    mpz_t upper;
+    mpz_init(upper);
+    product_of_words(result, words, lo, mid);
+    product_of_words(upper, words, mid, hi);
+    mpz_mul(result, result, upper);
+    mpz_clear(upper);
+}
+
+struct BinomialEngine {
+    // primes up to sieve_limit, ascending
+    // 64 bit so blocks of 2^32 symbols or more still factor correctly
+    std::vector<uint64_t> primes;
+    uint64_t sieve_limit = 1;
+    std::shared_mutex sieve_lock;
+
+    struct CachedValue {
+        mpz_t value;
+        CachedValue() { mpz_init(value); }
+        ~CachedValue() { mpz_clear(value); }
+    };
+    // (n, k) -> n choose k, cleared once it holds more than cache_limit bytes
+    std::map<std::pair<uint64_t, uint64_t>, std::unique_ptr<CachedValue>> cache;
+    size_t cache_bytes = 0;
+    size_t cache_limit = 64 << 20;
+    std::mutex cache_lock;
+
+    // make sure primes up to n are sieved, call once per block before using the engine
+    // from several threads so the sieve doesn't have to grow while others read it
+    void prepare(uint64_t n) {
+        {
+            std::shared_lock<std::shared_mutex> guard(sieve_lock);
+            if(n <= sieve_limit) {
+                return;
+            }
+        }
+        std::unique_lock<std::shared_mutex> guard(sieve_lock);
+        if(n <= sieve_limit) {
+            return;
+        }
+        // grow to at least double to avoid resieving for every slightly larger block
+        uint64_t limit = std::max(n, 2 * sieve_limit);
+        std::vector<bool> composite(limit + 1, false);
+        primes.clear();
+        for(uint64_t i = 2; i <= limit; i++) {
+            if(!composite[i]) {
+                primes.push_back(i);
+                if(i > limit / i) {
+                    // i*i is past the limit (and may not fit in 64 bits)
+                    continue;
+                }
+                for(uint64_t j = i * i; j <= limit; j += i) {
+                    composite[j] = true;
+                }
+            }
+        }
+        sieve_limit = limit;
+    }
+
+    // result = n choose k
+    // one-off values (e.g. restarting a ranker) skip the cache so they don't evict the radices
+    void binomial(mpz_t result, uint64_t n, uint64_t k, bool use_cache = true) {
+        if(k > n) {
+            mpz_set_ui(result, 0);
+            return;
+        }
+        k = std::min(k, n - k);
+        if(k == 0) {
+            mpz_set_ui(result, 1);
+            return;
+        }
+        if(k == 1) {
+            mpz_set_ui(result, n);
+            return;
+        }
+        if(use_cache) {
+            std::lock_guard<std::mutex> guard(cache_lock);
+            auto cached = cache.find({n, k});
+            if(cached != cache.end()) {
+                mpz_set(result, cached->second->value);
+                VALLI_TRACE_COUNT(TRACE_BINOMIAL_CACHE_HITS);
+                return;
+            }
+        }
+        VALLI_TRACE_COUNT(TRACE_BINOMIALS);
+        if(k <= small_k_limit) {
+            // few factors, scanning every prime up to n/2 costs more than GMP's small k algorithm
+            mpz_bin_uiui(result, n, k);
+        } else {
+            prepare(n);
+            std::vector<uint64_t> words;
+            {
+                std::shared_lock<std::shared_mutex> guard(sieve_lock);
+                primeFactorWords(n, k, words);
+            }
+            product_of_words(result, words, 0, words.size());
+        }
+        if(!use_cache) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(cache_lock);
+        size_t value_bytes = mpz_size(result) * sizeof(mp_limb_t);
+        if(cache_bytes + value_bytes > cache_limit) {
+            cache.clear();
+            cache_bytes = 0;
+        }
+        if(value_bytes <= cache_limit && cache.find({n, k}) == cache.end()) {
+            // cached values outlive the block, keep them out of the block's arena
+            GmpArenaPause pause;
+            std::unique_ptr<CachedValue> entry(new CachedValue());
+            mpz_set(entry->value, result);
+            cache[{n, k}] = std::move(entry);
+            cache_bytes += value_bytes;
+        }
+    }
+
+  private:
+    // below this k the prime scan costs more than the coefficient itself
+    static const uint64_t small_k_limit = 1024;
+
+    // pack the prime powers of n choose k (k <= n/2) into machine words
+    // sieve_lock must be held
+    void primeFactorWords(uint64_t n, uint64_t k, std::vector<uint64_t>& words) {
+        uint64_t word = 1;
+        auto multiply_word = [&](uint64_t factor) {
+            uint64_t next;
+            if(__builtin_mul_overflow(word, factor, &next)) {
+                words.push_back(word);
+                next = factor;
+            }
+            word = next;
+        };
+        uint64_t n_minus_k = n - k;
+        auto end = std::upper_bound(primes.begin(), primes.end(), n);
+        // primes in (n-k, n] divide n! once and neither k! nor (n-k)!
+        auto top = std::upper_bound(primes.begin(), end, n_minus_k);
+        for(auto p = top; p != end; p++) {
+            multiply_word(*p);
+        }
+        // primes in (n/2, n-k] cancel out, primes <= n/2 need their exponent
+        auto half = std::upper_bound(primes.begin(), top, n / 2);
+        for(auto p = primes.begin(); p != half; p++) {
+            uint64_t prime = *p;
+            // Legendre: exponent of p in m! = m/p + m/p^2 + ...
+            uint64_t exponent = 0;
+            for(uint64_t power = prime; power <= n; power *= prime) {
+                exponent += n/power - k/power - n_minus_k/power;
+                if(power > n / prime) {
+                    break;
+                }
+            }
+            for(; exponent > 0; exponent--) {
+                multiply_word(prime);
+            }
+        }
+        words.push_back(word);
+    }
+};
+
+// process wide engine, shared so the sieve and cache carry over between blocks and
+// between the encoder and decoder
+inline BinomialEngine& binomial_engine() {
+    static BinomialEngine engine;
+    return engine;
+}
@@ -0,0 +1,187 @@
+// Byte and bit streams over caller owned buffers
+// ByteWriter/ByteReader are the byte level streams the container is written to and read from.
+// BitWriter/BitReader pack variable width fields low bits first (the first field starts at
+// bit 0 of the first byte) through a 64 bit accumulator, so a field is one shift and mask
+// instead of a loop over bytes, and bytes are moved a word at a time.
+// Nothing here is x86 specific: bit lengths use std::countl_zero when the standard library has
+// it and the GCC/Clang builtin otherwise, words are assembled little endian on any CPU.
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>      // memcpy, memset
+#if __has_include(<bit>)
+#include <bit>          // countl_zero (C++20)
+#endif
+
+// bits needed for value, 0 for 0
+inline int bit_length(uint64_t value) {
+#if defined(__cpp_lib_bitops)
+    return 64 - std::countl_zero(value);
+#else
+    return value ? 64 - __builtin_clzll(value) : 0;
+#endif
+}
+
+inline uint64_t load_le64(const unsigned char* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+inline void store_le64(unsigned char* bytes, uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(bytes, &word, 8);
+}
+
+// Writes into a caller owned buffer.  Bytes past the capacity are counted but dropped,
+// so size tells how large the buffer needed to be.
+struct ByteWriter {
+    unsigned char* data;
+    size_t capacity;
+    size_t size = 0;
+
+    ByteWriter(unsigned char* data, size_t capacity) : data(data), capacity(capacity) {}
+
+    bool overflowed() {
+        return size > capacity;
+    }
+    ByteWriter& write(const char* bytes, size_t count) {
+        if(size + count <= capacity) {
+            memcpy(data + size, bytes, count);
+        }
+        size += count;
+        return *this;
+    }
+    ByteWriter& operator<<(unsigned char byte) {
+        if(size < capacity) {
+            data[size] = byte;
+        }
+        size++;
+        return *this;
+    }
+};
+
+// Reads from a caller owned buffer, with the same interface as an ifstream.
+// Reading past the end fails like a stream at EOF.
+struct ByteReader {
+    const unsigned char* data;
+    size_t size;
+    size_t position = 0;
+    bool failed = false;
+
+    ByteReader(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    ByteReader& read(char* bytes, size_t count) {
+        if(failed || count > size - position) {
+            failed = true;
+            memset(bytes, 0, count);
+            return *this;
+        }
+        memcpy(bytes, data + position, count);
+        position += count;
+        return *this;
+    }
+    // skip count bytes and return where they start in the buffer, null past the end
+    const unsigned char* take(size_t count) {
+        if(failed || count > size - position) {
+            failed = true;
+            return nullptr;
+        }
+        position += count;
+        return data + position - count;
+    }
+    explicit operator bool() const {
+        return !failed;
+    }
+    bool operator!() const {
+        return failed;
+    }
+};
+
+// Packs fields into a ByteWriter, call flush() after the last one
+struct BitWriter {
+    ByteWriter& out;
+    // pending bits, the lowest bits_pending are valid, always fewer than 8 between writes
+    uint64_t accumulator = 0;
+    int bits_pending = 0;
+
+    explicit BitWriter(ByteWriter& out) : out(out) {}
+
+    // the low bit_count bits of value, bit_count <= 56
+    void write(uint64_t value, int bit_count) {
+        if(bit_count == 0) {
+            return;
+        }
+        accumulator |= (value & (~0ull >> (64 - bit_count))) << bits_pending;
+        bits_pending += bit_count;
+        // move every complete byte out in one go
+        unsigned char bytes[8];
+        store_le64(bytes, accumulator);
+        int complete = bits_pending >> 3;
+        out.write((const char*)bytes, complete);
+        // at most 7 complete bytes, the shift stays below 64
+        accumulator >>= complete * 8;
+        bits_pending &= 7;
+    }
+
+    // write the last partial byte, the unused high bits are 0
+    void flush() {
+        if(bits_pending) {
+            out << (unsigned char)accumulator;
+        }
+        accumulator = 0;
+        bits_pending = 0;
+    }
+};
+
+// Unpacks fields written by BitWriter.  Reads past the end return zero bits and set overrun,
+// like a ByteReader at EOF.
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t bit_position = 0;
+    bool overrun = false;
+
+    BitReader(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    // next bit_count bits, bit_count <= 64
+    uint64_t read(int bit_count) {
+        if(bit_count > 56) {
+            // a word holds at least 57 bits past any starting bit, split longer fields
+            uint64_t low = read(32);
+            return low | (read(bit_count - 32) << 32);
+        }
+        if(bit_count == 0) {
+            return 0;
+        }
+        size_t byte = bit_position >> 3;
+        uint64_t word;
+        if(byte + 8 <= size) {
+            word = load_le64(data + byte);
+        } else {
+            // the last few bytes of the buffer, zero filled past the end
+            unsigned char tail[8] = {0};
+            if(byte < size) {
+                memcpy(tail, data + byte, size - byte);
+            }
+            word = load_le64(tail);
+        }
+        uint64_t value = (word >> (bit_position & 7)) & (~0ull >> (64 - bit_count));
+        bit_position += bit_count;
+        if(bit_position > size * 8) {
+            overrun = true;
+        }
+        return value;
+    }
+
+    // bytes holding the bits read so far, a partial last byte counts as read
+    size_t bytesUsed() {
+        return (bit_position + 7) >> 3;
+    }
+};
@@ -0,0 +1,288 @@
+// Block container for .vli files
+// Splits the input into independently coded blocks, so memory use and the size of the
+// bigint arithmetic are bounded by the block size instead of the file size.
+
+// File layout, integers marked (v) are variable length (7 bits per byte, low bits first):
+//   File header:
+//     "VLI"              3 bytes, magic
+//     version            1 byte
+//     symbol bytes       1 byte, 1, 2 or 4: width of a symbol, little endian in the input
+//                        (version 1 containers have no such field, their symbols are bytes)
+//     flags              1 byte, VLI_FLAG_* (versions 1 and 2 have no flags)
+//     block size (v)     max number of input bytes per block, a multiple of the symbol bytes
+//     block count (v)
+//     total size (v)     uncompressed bytes in the whole file
+//   Per block, repeated block count times:
+//     stages             1 byte, only with VLI_FLAG_STAGES: VLI_STAGE_* the block's bytes went through
+//                        before coding (byte symbols only), see pipeline-stages.hpp
+//     stage parameters (v) one per applied stage that has one, in stage order (the BWT's row)
+//     coding             1 byte, only with VLI_FLAG_CONTEXT: VLI_CODING_ORDER0 for the fields below,
+//                        VLI_CODING_ORDER1 for context streams instead (byte symbols only, see below)
+//     frequency table    FrequencyTable::serialize, the block length in symbols is the sum of its counts
+//                        (of the transformed bytes when stages were applied)
+//     payload length (v) bytes of encoded data, 0 when the encoded value is 0
+//     payload            mpz_export of the block's encoded value, most significant byte first
+//   Context streams, a VLI_CODING_ORDER1 block (see context-streams.hpp):
+//     context count (v)  streams in the block
+//     per stream, ascending by context:
+//       context          1 byte, the byte before every byte of the stream
+//       frequency table, payload length (v) and payload of the stream, like a block
+//   Block index, only with VLI_FLAG_INDEX, after the last block:
+//     block bytes (v)    container bytes of each block, block count times
+//     index offset       8 bytes little endian, where the block index starts in the file
+// Block i holds the input bytes from i * block size, so the index only needs where each block
+// starts in the container.  The index offset is always the last 8 bytes of the file, a reader
+// finds any block with two small reads instead of walking every frequency table before it.
+#pragma once
+
+#include <vector>
+#include <algorithm>    // equal
+#include <cstring>      // memcpy, memset
+#include <gmp.h>        // mpz_t
+
+#include "bitstream.hpp"
+#include "frequency-table.hpp"
+#include "utility-functions.hpp" // permutation_bits
+
+// bump whenever the layout above changes, the decoder reads its own version and every earlier one
+const uint8_t VLI_VERSION = 3;
+const char VLI_MAGIC[3] = {'V', 'L', 'I'};
+// default block size, the same as the old single file limit, keeps the encoded value
+// of a block small enough to stay near the CPU caches
+const uint64_t VLI_DEFAULT_BLOCK_SIZE = 64000;
+
+// header flags
+// block index after the last block, for random access
+const uint8_t VLI_FLAG_INDEX = 1;
+// blocks are coded with the alphabet partition tree instead of symbol by symbol, see alphabet-tree.hpp
+const uint8_t VLI_FLAG_WAVELET = 2;
+// every block starts with its coding, VLI_CODING_*, picked per block by the encoder
+const uint8_t VLI_FLAG_CONTEXT = 4;
+// every block starts with the pipeline stages applied to it, VLI_STAGE_*, picked per block by the encoder
+const uint8_t VLI_FLAG_STAGES = 8;
+// flags this decoder understands, containers with any other flag are rejected
+const uint8_t VLI_KNOWN_FLAGS = VLI_FLAG_INDEX | VLI_FLAG_WAVELET | VLI_FLAG_CONTEXT | VLI_FLAG_STAGES;
+
+// block codings, with VLI_FLAG_CONTEXT
+// a single frequency table and encoded value, the only coding without the flag
+const uint8_t VLI_CODING_ORDER0 = 0;
+// one frequency table and encoded value per context, the byte before, see context-streams.hpp
+const uint8_t VLI_CODING_ORDER1 = 1;
+
+// pipeline stages, with VLI_FLAG_STAGES, applied in this order and undone in reverse
+// Burrows-Wheeler transform, its parameter is the row of the original block
+const uint8_t VLI_STAGE_BWT = 1;
+// move to front, byte values to their recency ranks
+const uint8_t VLI_STAGE_MTF = 2;
+// runs of zero bytes to their bijective base 2 length, the only stage that changes the length
+const uint8_t VLI_STAGE_ZERO_RUN = 4;
+const uint8_t VLI_KNOWN_STAGES = VLI_STAGE_BWT | VLI_STAGE_MTF | VLI_STAGE_ZERO_RUN;
+
+// upper bound on a serialized byte frequency table: 6 bits for the first count's length,
+// up to 56 bits per count and one byte per symbol, see max_table_bytes for wider symbols
+const uint64_t VLI_MAX_TABLE_BYTES = 1 + 256 * 7 + 256;
+// upper bound on the container header: magic, version, symbol bytes, flags and 3 varints
+const uint64_t VLI_MAX_HEADER_BYTES = sizeof(VLI_MAGIC) + 3 + 3 * 10;
+
+// lower bound on a block: every block has at least a table byte and a payload length
+const uint64_t VLI_MIN_BLOCK_BYTES = 2;
+
+// upper bound on the block index of block_count blocks: a varint each and the index offset
+inline uint64_t max_index_bytes(uint64_t block_count) {
+    return block_count * 10 + 8;
+}
+
+// write a variable length integer, returns bytes written
+template<typename Output>
+inline uint64_t write_varint(Output& out_file, uint64_t value) {
+    uint64_t output_byte_count = 0;
+    do {
+        uint8_t byte_buffer = value & 0x7F;
+        value >>= 7;
+        if(value) {
+            // more bytes follow
+            byte_buffer |= 0x80;
+        }
+        out_file << byte_buffer;
+        output_byte_count++;
+    } while(value);
+    return output_byte_count;
+}
+
+// bytes write_varint takes for value
+inline uint64_t varint_bytes(uint64_t value) {
+    uint64_t byte_count = 1;
+    for(value >>= 7; value; value >>= 7) {
+        byte_count++;
+    }
+    return byte_count;
+}
+
+// read a variable length integer, returns bytes read, 0 on a read error or overlong value
+template<typename Input>
+inline uint64_t read_varint(Input& input_file, uint64_t& value) {
+    uint64_t read_byte_count = 0;
+    value = 0;
+    uint8_t byte_buffer;
+    do {
+        // 10 bytes is enough for 64 bits
+        if(read_byte_count == 10 || !input_file.read((char*)&byte_buffer, 1)) {
+            return 0;
+        }
+        value |= (uint64_t)(byte_buffer & 0x7F) << (7 * read_byte_count);
+        read_byte_count++;
+    } while(byte_buffer & 0x80);
+    return read_byte_count;
+}
+
+struct ContainerHeader {
+    uint8_t version = VLI_VERSION;
+    uint8_t symbol_bytes = 1;
+    uint8_t flags = 0;
+    uint64_t block_size = VLI_DEFAULT_BLOCK_SIZE;
+    uint64_t block_count = 0;
+    uint64_t total_size = 0;
+
+    // returns bytes written
+    template<typename Output>
+    uint64_t write(Output& out_file) {
+        out_file.write(VLI_MAGIC, sizeof(VLI_MAGIC));
+        out_file << version << symbol_bytes << flags;
+        uint64_t output_byte_count = sizeof(VLI_MAGIC) + 3;
+        output_byte_count += write_varint(out_file, block_size);
+        output_byte_count += write_varint(out_file, block_count);
+        output_byte_count += write_varint(out_file, total_size);
+        return output_byte_count;
+    }
+
+    // returns false if the file is not a .vli container of this version or an earlier one
+    template<typename Input>
+    bool read(Input& input_file) {
+        char magic[sizeof(VLI_MAGIC)];
+        if(!input_file.read(magic, sizeof(magic)) || !std::equal(magic, magic+sizeof(magic), VLI_MAGIC)) {
+            return false;
+        }
+        if(!input_file.read((char*)&version, 1) || version == 0 || version > VLI_VERSION) {
+            return false;
+        }
+        symbol_bytes = 1;
+        if(version >= 2 && (!input_file.read((char*)&symbol_bytes, 1) || (symbol_bytes != 1 && symbol_bytes != 2 && symbol_bytes != 4))) {
+            return false;
+        }
+        flags = 0;
+        if(version >= 3 && (!input_file.read((char*)&flags, 1) || (flags & ~VLI_KNOWN_FLAGS))) {
+            return false;
+        }
+        return read_varint(input_file, block_size) && read_varint(input_file, block_count) && read_varint(input_file, total_size);
+    }
+};
+
+// payload bytes of an encoded value, empty when the value is 0
+// (gmp would still report 1 byte for 0, the payload length already says it all)
+inline void mpz_to_payload(mpz_t data, std::vector<unsigned char>& payload) {
+    size_t out_size = (mpz_cmp_ui(data, 0) == 0) ? 0 : mpz_sizeinbase(data, 256);
+    payload.resize(out_size);
+    if(out_size) {
+        //         output_array,   word_count, order, size, endian, nails, data
+        mpz_export(payload.data(), NULL,       1,     1,    -1,     0,     data);
+    }
+}
+
+// inverse of mpz_to_payload, export and import must match
+// payload can point straight into a mapped file, it is only read
+inline void mpz_from_payload(const unsigned char* payload, size_t payload_size, mpz_t data) {
+    mpz_import(data, payload_size, 1, 1, -1, 0, payload);
+}
+
+// upper bound on a coded block's payload bytes from its sorted frequency table,
+// the same bound on the total permutations the kernels size the value with
+template<typename Symbol>
+inline uint64_t payload_bound(FrequencyTable<Symbol>& freqs) {
+    double bits = permutation_bits(freqs);
+    return bits > 1e-6 ? ((uint64_t)(bits + 1e-6) + 1 + 7) / 8 : 0;
+}
+
+// upper bound on the bytes write_block takes for a block with the sorted table freqs, without
+// coding it: the table, payload length and payload, to pick between codings before encoding
+template<typename Symbol>
+inline uint64_t coded_size_bound(FrequencyTable<Symbol>& freqs) {
+    unsigned char none;
+    ByteWriter table_size(&none, 0);
+    freqs.serialize(table_size);
+    uint64_t payload_bytes = payload_bound(freqs);
+    return table_size.size + varint_bytes(payload_bytes) + payload_bytes;
+}
+
+// write one block: frequency table, payload length, payload
+// returns bytes written, table_byte_count is set to the frequency table's share
+template<typename Output, typename Symbol>
+inline uint64_t write_block(Output& out_file, FrequencyTable<Symbol>& freqs, const std::vector<unsigned char>& payload, uint64_t& table_byte_count) {
+    table_byte_count = freqs.serialize(out_file);
+    uint64_t output_byte_count = table_byte_count + write_varint(out_file, payload.size());
+    out_file.write((const char *)payload.data(), payload.size());
+    output_byte_count += payload.size();
+    return output_byte_count;
+}
+
+// read one block written by write_block, freqs must be freshly constructed (all zero)
+// payload points into the reader's buffer instead of being copied, returns false on a read error
+template<typename Symbol>
+inline bool read_block(ByteReader& input, FrequencyTable<Symbol>& freqs, const unsigned char*& payload, size_t& payload_size) {
+    freqs.deserialize(input);
+    uint64_t size;
+    if(!input || !read_varint(input, size)) {
+        return false;
+    }
+    payload = input.take(size);
+    payload_size = size;
+    return (bool)input;
+}
+
+// write the block index, block_bytes holds the container bytes of every block in order
+// and index_offset is where the index starts in the file, returns bytes written
+template<typename Output>
+inline uint64_t write_block_index(Output& out_file, const std::vector<uint64_t>& block_bytes, uint64_t index_offset) {
+    uint64_t output_byte_count = 0;
+    for(uint64_t bytes : block_bytes) {
+        output_byte_count += write_varint(out_file, bytes);
+    }
+    unsigned char offset_bytes[8];
+    store_le64(offset_bytes, index_offset);
+    out_file.write((const char*)offset_bytes, sizeof(offset_bytes));
+    return output_byte_count + sizeof(offset_bytes);
+}
+
+// false if a whole container of input_size bytes, whose header took header_bytes, is too small
+// for the blocks its header declares.  Checked before anything is sized from the header, a few
+// bytes claiming an exabyte of blocks are rejected instead of allocating for them.
+inline bool header_fits(const ContainerHeader& header, size_t header_bytes, size_t input_size) {
+    return header_bytes <= input_size && header.block_count <= (input_size - header_bytes) / VLI_MIN_BLOCK_BYTES;
+}
+
+// read the block index at the end of a whole container whose header took header_bytes,
+// block_offsets receives where every block starts plus, last, where the index starts
+// returns false if the index doesn't match the header or the blocks don't add up to it
+inline bool read_block_index(const unsigned char* input, size_t input_size, const ContainerHeader& header, size_t header_bytes, std::vector<uint64_t>& block_offsets) {
+    if(input_size < header_bytes + 8) {
+        return false;
+    }
+    uint64_t index_offset = load_le64(input + input_size - 8);
+    // every index entry has at least a byte
+    if(index_offset < header_bytes || index_offset > input_size - 8
+       || header.block_count > input_size - 8 - index_offset || header.block_count > (index_offset - header_bytes) / VLI_MIN_BLOCK_BYTES) {
+        return false;
+    }
+    ByteReader reader(input + index_offset, input_size - 8 - index_offset);
+    block_offsets.resize(header.block_count + 1);
+    uint64_t block_offset = header_bytes;
+    for(uint64_t block_idx = 0; block_idx < header.block_count; block_idx++) {
+        uint64_t block_bytes;
+        if(!read_varint(reader, block_bytes) || block_bytes > index_offset - block_offset) {
+            return false;
+        }
+        block_offsets[block_idx] = block_offset;
+        block_offset += block_bytes;
+    }
+    block_offsets[header.block_count] = block_offset;
+    return block_offset == index_offset && reader.position == reader.size;
+}
@@ -0,0 +1,52 @@
+// Byte histogram
+// Counting one byte at a time into a single table stalls whenever a symbol repeats: every
+// increment has to wait for the previous store to the same counter to complete.  Text is
+// full of repeats (spaces, 'e', the most frequent symbol of a sparse block every time).
+// Consecutive bytes go to 4 separate sub-tables instead, so repeats in a row are independent
+// increments, and the sub-tables are summed at the end.  Bytes are loaded 4 at a time, the
+// next load is issued before the current word is counted.
+// The sub-tables are 32 bit to stay in L1 (4KB), inputs are counted in chunks so they can't overflow.
+// Wider loads (AVX2) were measured too, they don't help: the increments are the bottleneck, not the loads.
+#pragma once
+
+#include <cstdint>
+#include <cstring>      // memcpy, memset
+#include <algorithm>    // min
+
+// counts[b] = number of bytes equal to b in buffer
+inline void byte_histogram(const unsigned char* buffer, size_t size, uint64_t (&counts)[256]) {
+    memset(counts, 0, sizeof(counts));
+    // each sub-table counts at most a quarter of a chunk, well below 2^32
+    const size_t chunk_size = (size_t)1 << 32;
+    for(size_t chunk = 0; chunk < size; chunk += chunk_size) {
+        const unsigned char* in = buffer + chunk;
+        const unsigned char* end = in + std::min(chunk_size, size - chunk);
+        uint32_t tables[4][256];
+        memset(tables, 0, sizeof(tables));
+        if(end - in >= 20) {
+            uint32_t word;
+            memcpy(&word, in, 4);
+            in += 4;
+            // 16 bytes per iteration, word always holds the 4 bytes before in
+            while(end - in >= 16) {
+                for(int unroll = 0; unroll < 4; unroll++) {
+                    uint32_t current = word;
+                    memcpy(&word, in, 4);
+                    in += 4;
+                    tables[0][(unsigned char)current]++;
+                    tables[1][(unsigned char)(current >> 8)]++;
+                    tables[2][(unsigned char)(current >> 16)]++;
+                    tables[3][current >> 24]++;
+                }
+            }
+            // word wasn't counted yet
+            in -= 4;
+        }
+        while(in < end) {
+            tables[0][*in++]++;
+        }
+        for(int symbol = 0; symbol < 256; symbol++) {
+            counts[symbol] += (uint64_t)tables[0][symbol] + tables[1][symbol] + tables[2][symbol] + tables[3][symbol];
+        }
+    }
+}
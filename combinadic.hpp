@@ -0,0 +1,211 @@
+// Combinatorial number system helpers
+// A symbol's encoding is the sum of binomials: loc_1 choose 1 + loc_2 choose 2 + ... + loc_k choose k
+// where loc_i is the i-th location of the symbol among the remaining locations (strictly increasing).
+#pragma once
+
+#include <math.h>  // lgamma, log
+#include <gmp.h>   //mpz_t
+
+#include "binomial-engine.hpp"
+#include "bitstream.hpp"    // bit_length
+#include "trace.hpp"
+
+// true when stepping a binomial term across gap locations is cheaper than rebuilding it
+// the step costs roughly (gap * bits per factor) * (term size), rebuilding costs a few full size
+// multiplies, so step while the factor products stay small compared to the term
+inline bool step_is_cheaper(uint64_t gap, uint64_t max_loc, mpz_t term) {
+    uint64_t factor_bits = bit_length(max_loc | 1);
+    return gap * factor_bits <= 64 || gap * factor_bits * 4 <= mpz_sizeinbase(term, 2);
+}
+
+// product = lo * (lo+1) * ... * hi, or 1 when lo > hi
+// small factors are multiplied together in a machine word before touching the bignum
+inline void range_product(mpz_t product, uint64_t lo, uint64_t hi) {
+    mpz_set_ui(product, 1);
+    uint64_t word = 1;
+    for(uint64_t i = lo; i <= hi; i++) {
+        uint64_t next;
+        if(__builtin_mul_overflow(word, i, &next)) {
+            mpz_mul_ui(product, product, word);
+            next = i;
+        }
+        word = next;
+    }
+    mpz_mul_ui(product, product, word);
+}
+
+// Sums the binomials of one symbol's locations.
+// Consecutive terms are closely related, moving from loc choose k to loc' choose k+1 is
+//     (loc choose k) * [(loc+1)...(loc')] / [(k+1) * (loc-k+1)...(loc'-k-1)]
+// so when locations are close together the next term is one multiply and one exact division
+// of the previous term by small products, instead of rebuilding loc*(loc-1)*...*(loc-k+1)
+// with k multiplies and dividing by k!.  When the gap is large the term is computed directly.
+struct CombinationRanker {
+    mpz_t term, numerator, denominator;
+    // last location and count with a non zero term (loc >= k), count == 0 when there is none yet
+    uint64_t last_loc = 0;
+    uint64_t last_count = 0;
+
+    // term_bits: size of the largest term, usually the symbol's radix, so term never reallocates
+    explicit CombinationRanker(size_t term_bits = 0) {
+        mpz_init2(term, term_bits);
+        mpz_inits(numerator, denominator, NULL);
+    }
+    ~CombinationRanker() {
+        mpz_clears(term, numerator, denominator, NULL);
+    }
+    CombinationRanker(const CombinationRanker&) = delete;
+    CombinationRanker& operator=(const CombinationRanker&) = delete;
+
+    // add loc choose count to symbol_accumulator
+    // count must be one more than the previous call's, loc strictly greater
+    void add(uint64_t loc, uint64_t count, mpz_t symbol_accumulator) {
+        if(loc < count) {
+            // zero terms, these can only happen before the first non zero term
+            return;
+        }
+        if(last_count != 0 && step_is_cheaper(loc - last_loc, loc, term)) {
+            // (loc+1)...(loc')
+            range_product(numerator, last_loc + 1, loc);
+            // (k+1) * (loc-k+1)...(loc'-k-1)
+            range_product(denominator, last_loc - last_count + 1, loc - last_count - 1);
+            mpz_mul_ui(denominator, denominator, count);
+            mpz_mul(term, term, numerator);
+            mpz_divexact(term, term, denominator);
+            VALLI_TRACE_COUNT(TRACE_RANK_STEPS);
+        } else {
+            binomial_engine().binomial(term, loc, count, false);
+            VALLI_TRACE_COUNT(TRACE_RANK_RESTARTS);
+        }
+        last_loc = loc;
+        last_count = count;
+        mpz_add(symbol_accumulator, symbol_accumulator, term);
+    }
+};
+
+// Inverse of CombinationRanker: recovers a symbol's locations from its sum of binomials,
+// largest location first.  For count k, the location is the largest loc with
+// (loc choose k) <= remaining sum.
+// The location is estimated with floating point log-gamma values, so the bignums are only
+// used for the final correction: the exact term is stepped from the previous location's term
+// when the locations are close together, otherwise computed directly.
+struct CombinationUnranker {
+    mpz_t term, next_term, numerator, denominator;
+    // locations must be below upper_loc, which moves down after each location
+    uint64_t upper_loc = 0;
+    // term holds last_loc choose last_count, last_count == 0 when there is none
+    uint64_t last_loc = 0;
+    uint64_t last_count = 0;
+
+    // term_bits: size of the largest term, usually the symbol's radix
+    explicit CombinationUnranker(size_t term_bits = 0) {
+        mpz_init2(term, term_bits);
+        mpz_init2(next_term, term_bits);
+        mpz_inits(numerator, denominator, NULL);
+    }
+    ~CombinationUnranker() {
+        mpz_clears(term, next_term, numerator, denominator, NULL);
+    }
+    CombinationUnranker(const CombinationUnranker&) = delete;
+    CombinationUnranker& operator=(const CombinationUnranker&) = delete;
+
+    // start a new symbol, its locations are in [0, location_count)
+    void reset(uint64_t location_count) {
+        upper_loc = location_count;
+        last_count = 0;
+    }
+
+    // returns the location for count and subtracts (location choose count) from symbol_sum
+    // counts must be called in descending order down to 1
+    uint64_t next(mpz_t symbol_sum, uint64_t count) {
+        if(mpz_sgn(symbol_sum) == 0) {
+            // only zero terms remain: count-1 choose count == 0, all lower locations are taken
+            last_count = 0;
+            upper_loc = count - 1;
+            return count - 1;
+        }
+        // sum >= 1, so loc >= count, and loc < upper_loc
+        uint64_t hi = upper_loc - 1;
+        uint64_t loc = estimate(symbol_sum, count, hi);
+
+        // exact term for the estimate
+        if(last_count == count + 1 && step_is_cheaper(last_loc - loc, last_loc, term)) {
+            // last_loc choose count+1 -> loc choose count
+            // = * (count+1) / (last_loc-count)  -> last_loc choose count
+            // = * [(loc-count+1)...(last_loc-count)] / [(loc+1)...last_loc]
+            range_product(numerator, loc - count + 1, last_loc - count);
+            mpz_mul_ui(numerator, numerator, count + 1);
+            range_product(denominator, loc + 1, last_loc);
+            mpz_mul_ui(denominator, denominator, last_loc - count);
+            mpz_mul(term, term, numerator);
+            mpz_divexact(term, term, denominator);
+            VALLI_TRACE_COUNT(TRACE_UNRANK_STEPS);
+        } else {
+            binomial_engine().binomial(term, loc, count, false);
+            VALLI_TRACE_COUNT(TRACE_UNRANK_RESTARTS);
+        }
+
+        // correct the estimate, usually off by at most one
+        while(mpz_cmp(term, symbol_sum) > 0) {
+            // loc-1 choose k = loc choose k * (loc-k) / loc
+            mpz_mul_ui(term, term, loc - count);
+            mpz_divexact_ui(term, term, loc);
+            loc--;
+            VALLI_TRACE_COUNT(TRACE_UNRANK_CORRECTIONS);
+        }
+        while(loc < hi) {
+            // loc+1 choose k = loc choose k * (loc+1) / (loc+1-k)
+            mpz_mul_ui(next_term, term, loc + 1);
+            mpz_divexact_ui(next_term, next_term, loc + 1 - count);
+            if(mpz_cmp(next_term, symbol_sum) > 0) {
+                break;
+            }
+            mpz_swap(term, next_term);
+            loc++;
+            VALLI_TRACE_COUNT(TRACE_UNRANK_CORRECTIONS);
+        }
+
+        mpz_sub(symbol_sum, symbol_sum, term);
+        last_loc = loc;
+        last_count = count;
+        upper_loc = loc;
+        return loc;
+    }
+
+  private:
+    // largest loc in [count, hi] with log(loc choose count) <= log(symbol_sum), approximately
+    uint64_t estimate(mpz_t symbol_sum, uint64_t count, uint64_t hi) {
+        long exponent;
+        double mantissa = mpz_get_d_2exp(&exponent, symbol_sum);
+        // small slack so rounding errors land on the low side, the correction steps up
+        double target = log(mantissa) + exponent * M_LN2 + 1e-9;
+        double log_count_fact = lgamma(count + 1.0);
+        auto log_binomial = [&](uint64_t n) {
+            return lgamma(n + 1.0) - lgamma(n - count + 1.0) - log_count_fact;
+        };
+        if(hi <= count || log_binomial(hi) <= target) {
+            return hi < count ? count : hi;
+        }
+        // locations are usually close to the previous one, gallop down from hi
+        uint64_t lo = count;
+        uint64_t step = 1;
+        while(hi - lo > step) {
+            if(log_binomial(hi - step) <= target) {
+                lo = hi - step;
+                break;
+            }
+            hi -= step;
+            step *= 2;
+        }
+        // binary search, log_binomial(lo) <= target < log_binomial(hi)
+        while(hi - lo > 1) {
+            uint64_t mid = lo + (hi - lo)/2;
+            if(log_binomial(mid) <= target) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+};
@@ -0,0 +1,91 @@
+// Order 1 context streams, the context coding mode (VLI_FLAG_CONTEXT, VLI_CODING_ORDER1)
+// A single frequency table can't go below the order 0 multinomial, however much each byte depends
+// on the one before it.  Here a block's bytes are split by their context, the byte before them
+// (0 for the block's first byte, blocks stay independent): stream c holds, in order, every byte
+// that follows a c.  Each stream is coded like a block of its own, with its own frequency table,
+// so in English text the stream after 'q' is nearly all 'u' and costs almost nothing.
+// The decoder decodes every stream, then walks the block once: the context of each location is
+// the byte just written, its byte is the next one of that context's stream.
+// The streams don't depend on each other, only the final walk is sequential (a byte copy per location).
+// More tables cost more bytes, the encoder estimates both codings from the tables and the
+// multinomial bounds before coding anything and only picks order 1 when it's smaller.
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "frequency-table.hpp"
+#include "utility-functions.hpp" // CalcFrequencyPairs
+#include "block-container.hpp"   // coded_size_bound
+
+// number of contexts, one per byte value
+const size_t CONTEXT_COUNT = 256;
+
+// Split a block by context into streams, stream c is streams[stream_start[c], stream_start[c+1])
+// a stable counting sort on the byte before each location
+inline void context_split(const uint8_t* symbols, size_t size, std::vector<uint8_t>& streams, std::array<uint64_t, CONTEXT_COUNT + 1>& stream_start) {
+    stream_start.fill(0);
+    if(size == 0) {
+        streams.clear();
+        return;
+    }
+    // the first byte's context is 0, every other byte's the one before it
+    stream_start[1] = 1;
+    for(size_t i = 0; i + 1 < size; i++) {
+        stream_start[symbols[i] + 1]++;
+    }
+    for(size_t c = 0; c < CONTEXT_COUNT; c++) {
+        stream_start[c + 1] += stream_start[c];
+    }
+    streams.resize(size);
+    std::array<uint64_t, CONTEXT_COUNT> next;
+    std::copy(stream_start.begin(), stream_start.end() - 1, next.begin());
+    uint8_t context = 0;
+    for(size_t i = 0; i < size; i++) {
+        streams[next[context]++] = symbols[i];
+        context = symbols[i];
+    }
+}
+
+// Inverse of context_split, output receives the size bytes of the block
+// returns false if the streams run out (their lengths don't match the contexts they are read in)
+inline bool context_merge(const uint8_t* streams, const std::array<uint64_t, CONTEXT_COUNT + 1>& stream_start, uint8_t* output, size_t size) {
+    std::array<uint64_t, CONTEXT_COUNT> next;
+    std::copy(stream_start.begin(), stream_start.end() - 1, next.begin());
+    uint8_t context = 0;
+    for(size_t i = 0; i < size; i++) {
+        if(next[context] == stream_start[context + 1]) {
+            return false;
+        }
+        context = streams[next[context]++];
+        output[i] = context;
+    }
+    return true;
+}
+
+// Estimated container bytes of a block in order 0 coding (order0) and as context streams (order1),
+// the coding byte left out of both.  Upper bounds, a coded block is never larger.
+// streams and stream_start must hold the block's context_split
+inline void context_size_bounds(const uint8_t* symbols, size_t size, const std::vector<uint8_t>& streams,
+                                const std::array<uint64_t, CONTEXT_COUNT + 1>& stream_start, uint64_t& order0, uint64_t& order1) {
+    FreqChar freqs;
+    CalcFrequencyPairs(symbols, size, freqs);
+    freqs.sortData();
+    order0 = coded_size_bound(freqs);
+    // context count, then a context byte and a coded block per used context
+    uint64_t used = 0;
+    order1 = 0;
+    for(size_t c = 0; c < CONTEXT_COUNT; c++) {
+        uint64_t length = stream_start[c + 1] - stream_start[c];
+        if(length) {
+            FreqChar context_freqs;
+            CalcFrequencyPairs(streams.data() + stream_start[c], length, context_freqs);
+            context_freqs.sortData();
+            order1 += 1 + coded_size_bound(context_freqs);
+            used++;
+        }
+    }
+    order1 += varint_bytes(used);
+}
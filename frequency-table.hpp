@@ -3,195 +3,193 @@
 
 // Stores the symbols and frequencies used for compression/decompression
 // Serialization performs some basic bit packing, leveraging the sorted counts
-// followed by corresponding byte symbols, no compression
-
-
-#include <fstream>      // ifstream,ofstream
-#include <immintrin.h>  // lzcnt
+// followed by corresponding symbols, no compression
+// The counts are packed low bits first through BitWriter/BitReader (bitstream.hpp), portable C++.
+// Symbols are bytes by default (FreqChar), or 16 bit (UTF-16 text, sensor samples) and 32 bit
+// tokens, read little endian from the message.
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>    // sort, reverse, min
+#include <stdexcept>    // out_of_range
+#include <type_traits>  // conditional
+
+#include "bitstream.hpp" // ByteWriter, ByteReader, BitWriter, BitReader, bit_length
+
+// symbol at index idx of a message of Symbol sized little endian values
+template<typename Symbol>
+inline Symbol load_symbol(const char* message, size_t idx) {
+    const unsigned char* bytes = (const unsigned char*)message + idx * sizeof(Symbol);
+    Symbol symbol = 0;
+    for(size_t b = 0; b < sizeof(Symbol); b++) {
+        symbol |= (Symbol)bytes[b] << (8 * b);
+    }
+    return symbol;
+}
+
+template<typename Symbol>
+inline void store_symbol(char* message, size_t idx, Symbol symbol) {
+    unsigned char* bytes = (unsigned char*)message + idx * sizeof(Symbol);
+    for(size_t b = 0; b < sizeof(Symbol); b++) {
+        bytes[b] = (unsigned char)(symbol >> (8 * b));
+    }
+}
 
 // Simple structure to contain the dictionary information.
 // Array of 64 bit numbers,
-// The first 7 most significant bytes store the count
-// and the last byte stores the character being counted
+// The most significant bits store the count
+// and the low symbol_bits store the symbol being counted
 // This allows for sorting directly on the full 64 bits
-// Size is always 256*8 = 2048 bytes 
-struct FreqChar {
-    uint64_t data[256] = {0};
-    void setChar(unsigned char i, unsigned char symbol) {
-        data[i] = (data[i] & 0xFFFFFFFFFFFFFF00) | symbol;
+// Byte symbols keep an entry for every symbol, zero counts included (256*8 = 2048 bytes),
+// wider alphabets are mostly unused so only the symbols in the block get an entry (sparse).
+// Either way the entries are sorted ascending by count then symbol, the last is the most frequent.
+template<typename Symbol>
+struct FrequencyTable {
+    static_assert(sizeof(Symbol) == 1 || sizeof(Symbol) == 2 || sizeof(Symbol) == 4, "8, 16 or 32 bit symbols");
+    static constexpr int symbol_bits = 8 * sizeof(Symbol);
+    static constexpr uint64_t alphabet_size = 1ull << symbol_bits;
+    static constexpr uint64_t symbol_mask = alphabet_size - 1;
+    static constexpr bool dense = sizeof(Symbol) == 1;
+
+    typename std::conditional<dense, std::array<uint64_t, 256>, std::vector<uint64_t>>::type data{};
+
+    // number of entries, 256 for bytes, the used symbols otherwise
+    size_t size() {
+        return data.size();
     }
-    unsigned char getChar(unsigned char i) {
-        return data[i];
+    void setChar(size_t i, Symbol symbol) {
+        data[i] = (data[i] & ~symbol_mask) | symbol;
     }
-    void setCount(unsigned char i, size_t count) {
-        data[i] += count << 8;
+    Symbol getChar(size_t i) {
+        return (Symbol)data[i];
     }
-    uint64_t getCount(unsigned char i) {
-        return data[i] >> 8;
+    void setCount(size_t i, uint64_t count) {
+        data[i] += count << symbol_bits;
     }
-    void incrCount(unsigned char i) {
-        data[i] += 1ull << 8;
+    uint64_t getCount(size_t i) {
+        return data[i] >> symbol_bits;
+    }
+    void incrCount(size_t i) {
+        data[i] += 1ull << symbol_bits;
         //warning: no overflow detection
     }
     //sort the dictionary by frequency, ascending
     void sortData() {
-        std::sort(data, data+(sizeof(data)/sizeof(data[0])));
+        std::sort(data.begin(), data.end());
     }
 
     // A very basic freq table serialization
-    // bit packing of sorted counts, when count==0, we also know the number of byte symobls to read
-    // returns count of bytes written to file
-    uint64_t serialize(std::ofstream& out_file) {
-        uint64_t output_byte_count = 0;        
+    // bit packing of sorted counts, when count==0, we also know the number of symobls to read
+    // the zero count is left out when every symbol of the alphabet is used
+    // returns count of bytes written
+    uint64_t serialize(ByteWriter& out) {
+        size_t start = out.size;
+        BitWriter bits(out);
         // write the bit length of the largest count, max 6 bits
-        uint64_t count = (data[255] >> 8);
-        int8_t bit_length = (64 - _lzcnt_u64(count));
-        // !!! use last bit length, not current
-        int8_t last_bit_length = (64 - _lzcnt_u64(count));
-        uint8_t byte_buffer = last_bit_length;
-        uint8_t bit_offset = 6;
-        int non_zero = 0;
-        //bit pack the counts
-        for(int i=255; i>=0; i--) {
-            count = this->getCount(i);
-            bit_length = (64 - _lzcnt_u64(count));
-            int8_t bits_output = 0;
-            while(last_bit_length>bits_output) {
-                // if byte would fill, write and go next byte
-                if((last_bit_length-bits_output) >= (8 - bit_offset)) {
-                    byte_buffer |= count << bit_offset;
-                    count = count >> (8 - bit_offset);
-                    out_file << byte_buffer;
-                    output_byte_count++;
-                    bits_output += (8 - bit_offset);
-                    byte_buffer = 0;
-                    bit_offset = 0;
-                } else {
-                    // no overflow, insert and move offset
-                    byte_buffer |= count << bit_offset;
-                    bit_offset += last_bit_length-bits_output; //can't be >= 8 based on if
-                    bits_output += last_bit_length-bits_output; //can't be >= 8 based on if
-                }
-            }
-            if(this->getCount(i)==0) {
-                //exit loop
-                //todo: test with freqs that end here
+        // !!! each count is written with the last bit length, not its own
+        int last_bit_length = size() ? bit_length(this->getCount(size()-1)) : 0;
+        bits.write(last_bit_length, 6);
+        uint64_t non_zero = 0;
+        //bit pack the counts, largest first
+        for(size_t i=size(); i-- > 0;) {
+            uint64_t count = this->getCount(i);
+            if(count==0) {
                 break;
             }
+            bits.write(count, last_bit_length);
             non_zero++;
-            last_bit_length = bit_length;
-            // use the lenght of the current count to set the next one
+            // use the length of the current count to set the next one
+            last_bit_length = bit_length(count);
+        }
+        if(non_zero < alphabet_size) {
+            bits.write(0, last_bit_length);
         }
         // if unwritten bits in buffer, flush
         // this will waste at most 7 bits, could be used by encoding, skipping optimization for now
-        if(bit_offset != 0) {
-            out_file << byte_buffer;
-            output_byte_count++;
-        }
+        bits.flush();
 
-        //output non zero count symbols (bytes) in the same order as the sort (desc)
+        //output non zero count symbols in the same order as the sort (desc), little endian
         //todo: assert non_zero >= 1
-        for(int i=255; i>=(255-non_zero); i--) {
-            if(this->getCount(i)) {
-                out_file << this->getChar(i);
-                output_byte_count++;
-            } else {
-                break;
+        for(size_t i=size(); i-- > size()-non_zero;) {
+            Symbol symbol = this->getChar(i);
+            for(size_t b = 0; b < sizeof(Symbol); b++) {
+                out << (unsigned char)(symbol >> (8 * b));
             }
         }
-        return output_byte_count;
+        return out.size - start;
     }
 
-    // basic deserializer
+    // basic deserializer, the table must be freshly constructed
     // returns bytes read
-    uint64_t deserialize(std::ifstream& input_file) { 
-        //for legacy reasons, keep all zero counts in place
-        //todo: resize array for non-zero counts
-        //todo: assert file len > 1
-        uint64_t read_byte_count = 1;
+    uint64_t deserialize(ByteReader& in) {
+        //for legacy reasons, byte tables keep all zero counts in place
+        size_t start = in.position;
+        BitReader bits(in.data + in.position, in.failed ? 0 : in.size - in.position);
         // read first 6 bits for count bit length
-        uint8_t byte_buffer;
-        input_file.read((char*)&byte_buffer, 1);
-        uint8_t bit_length = byte_buffer & 0b00111111;
-
-        uint8_t bit_offset = 6;
-        int symbol_count = 0;
-        // count loop
-        do {
-            int64_t count = 0;
-            int8_t bits_read = 0;
-            // read bytes loop
-            while(bit_length>bits_read) {
-                if((bit_length-bits_read) >= (8 - bit_offset)) {
-                    // overflow, load then read next byte
-                    //load and read next byte, loop until done
-                    count |= ((uint64_t)(byte_buffer >> bit_offset)) << bits_read;
-                    bits_read += (8 - bit_offset);
-                    input_file.read((char*)&byte_buffer, 1);
-                    read_byte_count++;
-                    bit_offset = 0;
-                    //update bits read
-                } else {
-                    // fits in current byte
-                    // load count and update offset
-                    count |= ((uint64_t)(byte_buffer >> bit_offset)) << bits_read;
-                    //zero out bits beyond the length
-                    count &= ((1ull << (bit_length))-1);
-                    bit_offset += bit_length-bits_read;
-                    bits_read = bit_length;
-                }
-            }
-            //set the count, ascending order
-            this->setCount(255-symbol_count, count);
+        int last_bit_length = bits.read(6);
+        uint64_t symbol_count = 0;
+        // count loop, counts are in descending order
+        // with every symbol used there is no terminating zero count
+        while(symbol_count < alphabet_size) {
+            uint64_t count = bits.read(last_bit_length);
             // exit loop if the count is 0 (last in sequence)
             if(count==0) {
                 break;
             }
+            if constexpr(dense) {
+                //set the count, ascending order
+                this->setCount(255-symbol_count, count);
+            } else {
+                data.push_back(count << symbol_bits);
+            }
             symbol_count++;
             // update bit_length with current length
-            bit_length = (64 - _lzcnt_u64(count));
-
-        } while(symbol_count < 255); //for safety, can be removed, unreachable
-
-        // if bit_offset == 0, it contains a symbol
-        // else unset bits, read next byte
-        if(bit_offset != 0) {
-            input_file.read((char*)&byte_buffer, 1);
-            read_byte_count++;
+            last_bit_length = bit_length(count);
         }
-        // assert: symbol_count > 1
-        this->setChar(255, byte_buffer);
-        std::vector<uint8_t> found_symbols(symbol_count);
-        found_symbols.at(0) = byte_buffer;
-        // set characters
-        for(int i=254; i>(255-symbol_count); i--) {
-            input_file.read((char*)&byte_buffer, 1);
-            read_byte_count++;
-            this->setChar(i, byte_buffer);
-            found_symbols.at(255-i) = byte_buffer;
+        if constexpr(!dense) {
+            std::reverse(data.begin(), data.end());
         }
 
-        std::sort(found_symbols.begin(), found_symbols.end());
-        // print vector
-        int found_idx = 0;
-        for(int i=0; i<(256); i++) {
-            if(found_idx < symbol_count && i==found_symbols.at(found_idx)) {
-                //skip
-                found_idx++;
-            } else {
-                // update char
-                this->setChar(i-found_idx, i);
+        // the symbols start at the next byte boundary, a table cut short fails the reader
+        in.take(bits.bytesUsed());
+        if(symbol_count == 0) {
+            // every block has at least one symbol
+            throw std::out_of_range("frequency table without symbols");
+        }
+        const unsigned char* symbols = in.take(symbol_count * sizeof(Symbol));
+        if(!symbols) {
+            return in.position - start;
+        }
+        // set symbols, descending like the counts
+        for(size_t i=0; i<symbol_count; i++) {
+            this->setChar(size()-1-i, load_symbol<Symbol>((const char*)symbols, i));
+        }
+        if constexpr(dense) {
+            // legacy code: back fill the unused symbols below, ascending
+            bool found[256] = {false};
+            for(size_t i=0; i<symbol_count; i++) {
+                found[symbols[i]] = true;
+            }
+            int unused = 0;
+            for(int i=0; i<256; i++) {
+                if(!found[i]) {
+                    this->setChar(unused++, i);
+                }
             }
-
         }
-        // legacy code: back fill other symbols
-        // vector symbol_count
-
-
-        return read_byte_count;
-        //unique_symbols += 1; // 0 is never used
-    }    
+        return in.position - start;
+    }
 
 };
 
+// byte symbols, the original table
+typedef FrequencyTable<uint8_t> FreqChar;
 
+// upper bound on a serialized frequency table with at most symbols used symbols of symbol_bytes each:
+// 6 bits for the first count's length, up to 56 bits per count and the terminating zero, and the symbols
+inline uint64_t max_table_bytes(uint64_t symbol_bytes, uint64_t symbols) {
+    uint64_t alphabet_size = 1ull << (8 * symbol_bytes);
+    symbols = std::min(symbols, alphabet_size);
+    return 1 + std::min(symbols + 1, alphabet_size) * 7 + symbols * symbol_bytes;
+}
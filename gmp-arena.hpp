@@ -0,0 +1,341 @@
+// Arena allocator for GMP
+// Every bignum of a block is temporary, so instead of going through malloc/realloc/free for
+// each limb array, GMP allocates from a per thread bump arena that is rewound between blocks.
+// An arena rewinds itself: the first allocation after all of its allocations were freed (a
+// block's bignums are all cleared when it ends) starts over at the first chunk, so the codec
+// and every caller of it get the rewind without asking for one.
+// The chunks of an arena are kept after a rewind, so once the first blocks have sized them
+// malloc is no longer called at all.  They are freed when the thread exits (or, if some of its
+// allocations are still in use then, when the last of them is freed).
+//   - Freeing is free: the space is reclaimed when the block ends (or right away when it was
+//     the last allocation, which covers GMP's stack like temporaries).
+//   - Growing the last allocation is done in place, accumulators don't copy on every carry.
+//   - Values that outlive a block (the binomial cache) are allocated while the arena is
+//     paused and go to the heap, every allocation carries a small header saying where it came from.
+// Installed once with gmp_arena_install(), before any mpz_t is initialized.
+#pragma once
+
+#include <iostream>     // cout
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>    // min, max, find
+#include <cstdlib>      // malloc, free
+#include <cstring>      // memcpy
+#include <gmp.h>        // mp_set_memory_functions
+
+struct GmpArena {
+    // in front of every allocation, keeps the user pointer 16 byte aligned
+    struct alignas(16) Header {
+        // null for heap allocations
+        GmpArena* owner;
+        size_t unused;
+    };
+    struct Chunk {
+        char* data;
+        size_t size;
+    };
+    std::vector<Chunk> chunks;
+    // allocation point: chunk index and offset in it
+    size_t chunk_idx = 0;
+    size_t offset = 0;
+    // arena allocations not yet freed plus one while the owning thread runs, the arena is only
+    // rewound when this is 1 and deleted when it drops to 0
+    std::atomic<int64_t> references{1};
+
+    // statistics, since the last rewind (block) and since the start
+    uint64_t block_allocations = 0;
+    uint64_t block_chunk_mallocs = 0;
+    size_t block_peak_bytes = 0;
+    uint64_t total_allocations = 0;
+    uint64_t total_chunk_mallocs = 0;
+    size_t peak_bytes = 0;
+
+    static const size_t first_chunk_size = 1 << 20;
+
+    ~GmpArena() {
+        for(Chunk& chunk : chunks) {
+            free(chunk.data);
+        }
+    }
+
+    // bytes handed out since the last rewind
+    size_t usedBytes() {
+        size_t used = offset;
+        for(size_t i = 0; i < chunk_idx; i++) {
+            used += chunks[i].size;
+        }
+        return used;
+    }
+
+    // nothing allocated is in use, only the owning thread can add to it
+    bool unused() {
+        return references == 1;
+    }
+
+    // size bytes including the header, 16 byte aligned
+    void* allocate(size_t size) {
+        size = (size + 15) & ~(size_t)15;
+        if(unused()) {
+            // the previous block's bignums are all gone
+            chunk_idx = 0;
+            offset = 0;
+        }
+        while(chunk_idx < chunks.size() && offset + size > chunks[chunk_idx].size) {
+            // skip to the next chunk kept from an earlier block, the tail of this one is lost until the rewind
+            chunk_idx++;
+            offset = 0;
+        }
+        if(chunk_idx == chunks.size()) {
+            size_t chunk_size = chunks.empty() ? first_chunk_size : 2 * chunks.back().size;
+            while(chunk_size < size) {
+                chunk_size *= 2;
+            }
+            chunks.push_back({(char*)malloc(chunk_size), chunk_size});
+            offset = 0;
+            block_chunk_mallocs++;
+            total_chunk_mallocs++;
+        }
+        void* ptr = chunks[chunk_idx].data + offset;
+        offset += size;
+        references++;
+        block_allocations++;
+        total_allocations++;
+        size_t used = usedBytes();
+        block_peak_bytes = std::max(block_peak_bytes, used);
+        peak_bytes = std::max(peak_bytes, used);
+        return ptr;
+    }
+
+    // true when ptr..ptr+size is the last allocation of the current chunk
+    bool isTop(void* ptr, size_t size) {
+        size = (size + 15) & ~(size_t)15;
+        return chunk_idx < chunks.size() && (char*)ptr + size == chunks[chunk_idx].data + offset;
+    }
+
+    // grow or shrink the last allocation in place, false if it isn't the last or doesn't fit
+    bool resizeTop(void* ptr, size_t old_size, size_t new_size) {
+        if(!isTop(ptr, old_size)) {
+            return false;
+        }
+        size_t start = (char*)ptr - chunks[chunk_idx].data;
+        new_size = (new_size + 15) & ~(size_t)15;
+        if(start + new_size > chunks[chunk_idx].size) {
+            return false;
+        }
+        offset = start + new_size;
+        size_t used = usedBytes();
+        block_peak_bytes = std::max(block_peak_bytes, used);
+        peak_bytes = std::max(peak_bytes, used);
+        return true;
+    }
+
+    // only the owning thread may call this, other threads only drop the reference
+    void release(void* ptr, size_t size) {
+        if(isTop(ptr, size)) {
+            offset = (char*)ptr - chunks[chunk_idx].data;
+        }
+    }
+
+    // drop a reference, the arena is deleted with the last one
+    // returns true if it was deleted
+    bool unreference() {
+        if(--references == 0) {
+            delete this;
+            return true;
+        }
+        return false;
+    }
+
+    // start the block statistics over and the allocations at the first chunk,
+    // the allocations are kept if some are still in use
+    bool rewind() {
+        block_allocations = 0;
+        block_chunk_mallocs = 0;
+        block_peak_bytes = 0;
+        if(!unused()) {
+            return false;
+        }
+        chunk_idx = 0;
+        offset = 0;
+        return true;
+    }
+};
+
+// Process wide state of the allocator: the arena of every running thread that allocated through GMP
+struct GmpArenaRegistry {
+    std::mutex lock;
+    std::vector<GmpArena*> arenas;
+    // allocations that went to the heap, paused or outside of the arenas
+    std::atomic<uint64_t> heap_allocations{0};
+    // totals of the arenas of threads that exited
+    uint64_t retired_allocations = 0;
+    uint64_t retired_chunk_mallocs = 0;
+    size_t retired_peak_bytes = 0;
+    size_t retired_count = 0;
+
+    GmpArena* newArena() {
+        std::lock_guard<std::mutex> guard(lock);
+        arenas.push_back(new GmpArena());
+        return arenas.back();
+    }
+
+    // the owning thread exits, its statistics are kept
+    void retire(GmpArena* arena) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            arenas.erase(std::find(arenas.begin(), arenas.end(), arena));
+            retired_allocations += arena->total_allocations;
+            retired_chunk_mallocs += arena->total_chunk_mallocs;
+            retired_peak_bytes += arena->peak_bytes;
+            retired_count++;
+        }
+        arena->unreference();
+    }
+};
+
+inline GmpArenaRegistry& gmp_arena_registry() {
+    static GmpArenaRegistry registry;
+    return registry;
+}
+
+// Holds a thread's arena, retires it when the thread exits
+struct GmpThreadArena {
+    GmpArena* arena = nullptr;
+    ~GmpThreadArena() {
+        if(arena) {
+            gmp_arena_registry().retire(arena);
+            arena = nullptr;
+        }
+    }
+};
+
+// this thread's arena, created on its first allocation
+inline GmpArena*& gmp_thread_arena() {
+    static thread_local GmpThreadArena holder;
+    return holder.arena;
+}
+
+// > 0 while this thread's allocations must outlive the block
+inline int& gmp_arena_paused() {
+    static thread_local int paused = 0;
+    return paused;
+}
+
+// Allocations in scope go to the heap, for values that outlive the current block
+struct GmpArenaPause {
+    GmpArenaPause() { gmp_arena_paused()++; }
+    ~GmpArenaPause() { gmp_arena_paused()--; }
+    GmpArenaPause(const GmpArenaPause&) = delete;
+    GmpArenaPause& operator=(const GmpArenaPause&) = delete;
+};
+
+inline void* gmp_arena_allocate(size_t size) {
+    GmpArena::Header* header;
+    if(gmp_arena_paused()) {
+        header = (GmpArena::Header*)malloc(sizeof(GmpArena::Header) + size);
+        header->owner = nullptr;
+        gmp_arena_registry().heap_allocations++;
+    } else {
+        GmpArena*& arena = gmp_thread_arena();
+        if(!arena) {
+            arena = gmp_arena_registry().newArena();
+        }
+        header = (GmpArena::Header*)arena->allocate(sizeof(GmpArena::Header) + size);
+        header->owner = arena;
+    }
+    return header + 1;
+}
+
+inline void gmp_arena_free(void* ptr, size_t size) {
+    GmpArena::Header* header = (GmpArena::Header*)ptr - 1;
+    GmpArena* owner = header->owner;
+    if(!owner) {
+        free(header);
+        return;
+    }
+    if(owner == gmp_thread_arena()) {
+        owner->release(header, sizeof(GmpArena::Header) + size);
+    }
+    owner->unreference();
+}
+
+inline void* gmp_arena_reallocate(void* ptr, size_t old_size, size_t new_size) {
+    GmpArena::Header* header = (GmpArena::Header*)ptr - 1;
+    GmpArena* owner = header->owner;
+    if(owner && owner == gmp_thread_arena() && !gmp_arena_paused() &&
+       owner->resizeTop(header, sizeof(GmpArena::Header) + old_size, sizeof(GmpArena::Header) + new_size)) {
+        return ptr;
+    }
+    if(!owner && gmp_arena_paused()) {
+        header = (GmpArena::Header*)realloc(header, sizeof(GmpArena::Header) + new_size);
+        return header + 1;
+    }
+    void* new_ptr = gmp_arena_allocate(new_size);
+    memcpy(new_ptr, ptr, std::min(old_size, new_size));
+    gmp_arena_free(ptr, old_size);
+    return new_ptr;
+}
+
+// route all GMP allocations through the arenas, call before the first mpz_init
+inline void gmp_arena_install() {
+    mp_set_memory_functions(gmp_arena_allocate, gmp_arena_reallocate, gmp_arena_free);
+}
+
+// start the block statistics of every thread's arena over, call between blocks when no thread
+// is using GMP (all of the block's bignums cleared and the pool idle)
+// The arenas rewind by themselves, this only matters for print_gmp_block_stats.
+inline void gmp_arena_rewind() {
+    GmpArenaRegistry& registry = gmp_arena_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    for(auto& arena : registry.arenas) {
+        arena->rewind();
+    }
+}
+
+// sum of the statistics of every arena
+struct GmpArenaStats {
+    uint64_t block_allocations = 0;
+    uint64_t block_chunk_mallocs = 0;
+    size_t block_peak_bytes = 0;
+    uint64_t total_allocations = 0;
+    uint64_t total_chunk_mallocs = 0;
+    size_t peak_bytes = 0;
+    uint64_t heap_allocations = 0;
+    size_t arena_count = 0;
+};
+
+inline GmpArenaStats gmp_arena_stats() {
+    GmpArenaRegistry& registry = gmp_arena_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    GmpArenaStats stats;
+    for(auto& arena : registry.arenas) {
+        stats.block_allocations += arena->block_allocations;
+        stats.block_chunk_mallocs += arena->block_chunk_mallocs;
+        stats.block_peak_bytes += arena->block_peak_bytes;
+        stats.total_allocations += arena->total_allocations;
+        stats.total_chunk_mallocs += arena->total_chunk_mallocs;
+        stats.peak_bytes += arena->peak_bytes;
+    }
+    stats.total_allocations += registry.retired_allocations;
+    stats.total_chunk_mallocs += registry.retired_chunk_mallocs;
+    stats.peak_bytes += registry.retired_peak_bytes;
+    stats.heap_allocations = registry.heap_allocations;
+    stats.arena_count = registry.arenas.size() + registry.retired_count;
+    return stats;
+}
+
+// verbose output: GMP allocations of the block that just finished, call before gmp_arena_rewind
+inline void print_gmp_block_stats() {
+    GmpArenaStats stats = gmp_arena_stats();
+    std::cout << "GMP arena allocations: " << stats.block_allocations << ", chunk mallocs: " << stats.block_chunk_mallocs
+              << ", peak arena bytes: " << stats.block_peak_bytes << std::endl;
+}
+
+// verbose output: GMP allocations of the whole run
+inline void print_gmp_total_stats() {
+    GmpArenaStats stats = gmp_arena_stats();
+    std::cout << "GMP arena allocations: " << stats.total_allocations << " in " << stats.arena_count << " arenas" << std::endl;
+    std::cout << "GMP heap allocations (malloc): " << stats.total_chunk_mallocs << " arena chunks + " << stats.heap_allocations << " cached values" << std::endl;
+    std::cout << "GMP peak arena bytes: " << stats.peak_bytes << std::endl;
+}
@@ -0,0 +1,144 @@
+// C interface of the Valli encoding library, see valli.h
+// clang++ -std=c++17 -O2 -c libvalli.cpp && ar rcs libvalli.a libvalli.o
+
+#include <new>  // nothrow, bad_alloc
+
+#include "valli.h"
+#include "valli.hpp"
+
+struct valli_encoder {
+    ValliEncoder encoder;
+    valli_encoder(uint64_t block_size, size_t threads, int symbol_bytes) : encoder(block_size, threads, symbol_bytes) {}
+};
+
+struct valli_decoder {
+    ValliDecoder decoder;
+    explicit valli_decoder(size_t threads) : decoder(threads) {}
+};
+
+// No exception may unwind into a C caller: allocations sized from a corrupt header are the
+// likely source, anything else thrown can only come from inconsistent input.  Exceptions of the
+// codec's pool threads get here too, ThreadPool::wait rethrows them on the calling thread.
+template<typename Call>
+static valli_status guarded(Call call) {
+    try {
+        return call();
+    } catch(const std::bad_alloc&) {
+        return VALLI_ERROR_OUT_OF_MEMORY;
+    } catch(...) {
+        return VALLI_ERROR_CORRUPT;
+    }
+}
+
+// constructors start thread pools and allocate, NULL if any of it fails
+template<typename Object, typename... Args>
+static Object* new_guarded(Args... args) {
+    try {
+        return new (std::nothrow) Object(args...);
+    } catch(...) {
+        return NULL;
+    }
+}
+
+extern "C" {
+
+valli_encoder* valli_encoder_new(uint64_t block_size, size_t threads) {
+    return new_guarded<valli_encoder>(block_size, threads, 1);
+}
+
+valli_encoder* valli_encoder_new_symbols(uint64_t block_size, size_t threads, int symbol_bytes) {
+    if(!ValliEncoder::validSymbolBytes(symbol_bytes)) {
+        return NULL;
+    }
+    return new_guarded<valli_encoder>(block_size, threads, symbol_bytes);
+}
+
+void valli_encoder_free(valli_encoder* encoder) {
+    delete encoder;
+}
+
+void valli_encoder_set_block_index(valli_encoder* encoder, int enabled) {
+    encoder->encoder.block_index = enabled != 0;
+}
+
+void valli_encoder_set_wavelet(valli_encoder* encoder, int enabled) {
+    encoder->encoder.wavelet = enabled != 0;
+}
+
+void valli_encoder_set_contexts(valli_encoder* encoder, int enabled) {
+    encoder->encoder.contexts = enabled != 0;
+}
+
+void valli_encoder_set_stages(valli_encoder* encoder, int stages) {
+    static_assert(VALLI_STAGE_BWT == VLI_STAGE_BWT && VALLI_STAGE_MTF == VLI_STAGE_MTF && VALLI_STAGE_ZERO_RUN == VLI_STAGE_ZERO_RUN, "stage bits");
+    // bits above the byte still fail the encode
+    encoder->encoder.stages = stages & ~0xFF ? 0xFF : stages;
+}
+
+size_t valli_max_encoded_size(uint64_t input_size, uint64_t block_size) {
+    return ValliEncoder::maxEncodedSize(input_size, block_size);
+}
+
+size_t valli_encoder_max_encoded_size(valli_encoder* encoder, uint64_t input_size) {
+    return ValliEncoder::maxEncodedSize(input_size, encoder->encoder.blockSize(), encoder->encoder.symbolBytes());
+}
+
+valli_status valli_encode(valli_encoder* encoder, const void* input, size_t input_size,
+                          void* output, size_t output_capacity, size_t* output_size) {
+    return guarded([&] {
+        return encoder->encoder.encode((const char*)input, input_size, (unsigned char*)output, output_capacity, output_size);
+    });
+}
+
+valli_decoder* valli_decoder_new(size_t threads) {
+    return new_guarded<valli_decoder>(threads);
+}
+
+void valli_decoder_free(valli_decoder* decoder) {
+    delete decoder;
+}
+
+valli_status valli_decoded_size(const void* input, size_t input_size, uint64_t* decoded_size) {
+    return guarded([&] {
+        return ValliDecoder::decodedSize((const unsigned char*)input, input_size, decoded_size);
+    });
+}
+
+valli_status valli_decode(valli_decoder* decoder, const void* input, size_t input_size,
+                          void* output, size_t output_capacity, size_t* output_size) {
+    return guarded([&] {
+        return decoder->decoder.decode((const unsigned char*)input, input_size, (char*)output, output_capacity, output_size);
+    });
+}
+
+valli_status valli_decode_range(valli_decoder* decoder, const void* input, size_t input_size,
+                                uint64_t offset, uint64_t length,
+                                void* output, size_t output_capacity, size_t* output_size) {
+    return guarded([&] {
+        return decoder->decoder.decodeRange((const unsigned char*)input, input_size, offset, length, (char*)output, output_capacity, output_size);
+    });
+}
+
+valli_status valli_count(valli_decoder* decoder, const void* input, size_t input_size, uint32_t symbol,
+                         uint64_t* occurrences, uint64_t* blocks_containing) {
+    return guarded([&] {
+        return decoder->decoder.count((const unsigned char*)input, input_size, symbol, occurrences, blocks_containing);
+    });
+}
+
+valli_status valli_locate(valli_decoder* decoder, const void* input, size_t input_size, uint32_t symbol,
+                          uint64_t* positions, size_t positions_capacity, size_t* found) {
+    *found = 0;
+    return guarded([&] {
+        std::vector<uint64_t> located;
+        valli_status status = decoder->decoder.locate((const unsigned char*)input, input_size, symbol, located);
+        *found = located.size();
+        std::copy(located.begin(), located.begin() + std::min(located.size(), positions_capacity), positions);
+        if(status == VALLI_OK && located.size() > positions_capacity) {
+            return VALLI_ERROR_OUTPUT_TOO_SMALL;
+        }
+        return status;
+    });
+}
+
+}
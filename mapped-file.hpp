@@ -0,0 +1,155 @@
+// Memory mapped file I/O
+// Input files are mapped read only and handed to the codec in place, nothing is copied
+// through a stream.  Output files are created at their final (or maximum) size and mapped,
+// the codec writes straight into the mapping and the file is trimmed to the bytes used on close.
+// When an input file can't be mapped (pipes, some network filesystems) the contents go through
+// one read() into memory instead.  Output files must be mapped: their size comes from the input
+// (a container header), so a heap buffer of that size is no fallback.
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fcntl.h>      // open
+#include <unistd.h>     // read, close, ftruncate, unlink
+#include <sys/mman.h>   // mmap, madvise
+#include <sys/stat.h>   // fstat
+
+struct MappedInputFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    MappedInputFile() {}
+    ~MappedInputFile() {
+        close();
+    }
+    MappedInputFile(const MappedInputFile&) = delete;
+    MappedInputFile& operator=(const MappedInputFile&) = delete;
+
+    // returns false if the file can't be opened or read
+    // sequential false is for files read in a few scattered places (a range of a .vli), no read ahead
+    bool open(const std::string& path, bool sequential = true) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size = file_stat.st_size;
+        if(S_ISREG(file_stat.st_mode) && size > 0) {
+            void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping != MAP_FAILED) {
+                // read once front to back, let the kernel read ahead and drop pages behind
+                madvise(mapping, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                data = (const unsigned char*)mapping;
+                mapped = true;
+            }
+        }
+        // pipes, empty files and files that report no size (e.g. /proc) are read instead
+        bool ok = mapped || readAll(fd);
+        ::close(fd);
+        return ok;
+    }
+
+    void close() {
+        if(mapped) {
+            munmap((void*)data, size);
+        }
+        mapped = false;
+        data = nullptr;
+        size = 0;
+        fallback.clear();
+    }
+
+  private:
+    bool mapped = false;
+    std::vector<unsigned char> fallback;
+
+    bool readAll(int fd) {
+        fallback.clear();
+        unsigned char chunk[1 << 16];
+        ssize_t count;
+        while((count = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            fallback.insert(fallback.end(), chunk, chunk + count);
+        }
+        data = fallback.data();
+        size = fallback.size();
+        return count == 0;
+    }
+};
+
+struct MappedOutputFile {
+    unsigned char* data = nullptr;
+    size_t capacity = 0;
+
+    MappedOutputFile() {}
+    ~MappedOutputFile() {
+        close(0);
+    }
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    // create or truncate path with room for capacity bytes and map it
+    // returns false, and removes the file, if it can't be created at that size or mapped
+    bool open(const std::string& path, size_t capacity) {
+        close(0);
+        this->path = path;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        if(capacity == 0) {
+            // nothing to map, close leaves the file empty
+            return true;
+        }
+        if(ftruncate(fd, capacity) == 0) {
+            void* mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(mapping != MAP_FAILED) {
+                // written once front to back
+                madvise(mapping, capacity, MADV_SEQUENTIAL);
+                data = (unsigned char*)mapping;
+                this->capacity = capacity;
+                mapped = true;
+                return true;
+            }
+        }
+        ::close(fd);
+        fd = -1;
+        unlink(path.c_str());
+        return false;
+    }
+
+    // close and remove the file, for output that failed part way
+    void discard() {
+        if(fd >= 0) {
+            close(0);
+            unlink(path.c_str());
+        }
+    }
+
+    // keep the first size bytes and close the file, returns false on a write error
+    bool close(size_t size) {
+        if(fd < 0) {
+            return true;
+        }
+        bool ok = true;
+        if(mapped) {
+            munmap(data, capacity);
+            ok = ftruncate(fd, size) == 0;
+        }
+        ok = (::close(fd) == 0) && ok;
+        fd = -1;
+        mapped = false;
+        data = nullptr;
+        capacity = 0;
+        return ok;
+    }
+
+  private:
+    std::string path;
+    int fd = -1;
+    bool mapped = false;
+};
@@ -0,0 +1,173 @@
+// Machine word kernels for small blocks
+// When the total number of permutations of a block (the multinomial of its symbol counts)
+// fits in 64 or 128 bits, every radix, digit and sum of binomials fits too, since they are
+// all below the total.  These kernels do the same math as the GMP path with uint64_t or
+// unsigned __int128 and produce the same encoded value, without any mpz allocation or call.
+// The word size is picked from the frequency table alone, so the decoder picks the same one.
+#pragma once
+
+#include <vector>
+#include <string>
+#include <numeric>      // gcd
+#include <algorithm>    // min, reverse
+
+#include "utility-functions.hpp"
+
+// bits of a native word the block's encoding fits in: 64, 128, or 0 when it needs GMP
+// log2 of the multinomial is estimated with log-gamma, the kernels still check every
+// multiply for overflow so an estimate on the edge falls back to GMP instead of failing
+template<typename Symbol>
+inline int native_word_bits(FrequencyTable<Symbol>& freqs) {
+    // small slack for rounding, the total must be below 2^bits
+    double max_bit_length = permutation_bits(freqs) + 1e-6;
+    if(max_bit_length < 64) {
+        return 64;
+    }
+    if(max_bit_length < 128) {
+        return 128;
+    }
+    return 0;
+}
+
+template<typename Word>
+struct NativeKernel {
+    // result = n choose k, false if it doesn't fit in Word
+    static bool binomial(uint64_t n, uint64_t k, Word& result) {
+        if(k > n) {
+            result = 0;
+            return true;
+        }
+        k = std::min(k, n - k);
+        result = 1;
+        for(uint64_t i = 1; i <= k; i++) {
+            // result * (n-k+i) / i is exact, cancelling the common factor of result and i first
+            // leaves a divisor of (n-k+i), so nothing grows past the final value
+            uint64_t divisor = i / std::gcd((uint64_t)(result % i), i);
+            uint64_t factor = (n - k + i) / divisor;
+            result /= i / divisor;
+            if(__builtin_mul_overflow(result, (Word)factor, &result)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // radices of every digit and their product, false if the product doesn't fit
+    static bool radices(std::vector<uint64_t>& digit_remaining, std::vector<uint64_t>& digit_count_of, std::vector<Word>& symbol_radices, Word& total) {
+        symbol_radices.resize(digit_count_of.size());
+        total = 1;
+        for(size_t digit_idx = 0; digit_idx < digit_count_of.size(); digit_idx++) {
+            if(!binomial(digit_remaining[digit_idx], digit_count_of[digit_idx], symbol_radices[digit_idx])) {
+                return false;
+            }
+            if(__builtin_mul_overflow(total, symbol_radices[digit_idx], &total)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // sum of binomials of one symbol, locs[i] is the location of instance i+1
+    // false if a term doesn't fit, which can't happen when the radices fit
+    static bool rank(const size_t* locs, uint64_t count, Word& symbol_sum) {
+        symbol_sum = 0;
+        for(uint64_t instance = 0; instance < count; instance++) {
+            Word term;
+            if(!binomial(locs[instance], instance + 1, term) || __builtin_add_overflow(symbol_sum, term, &symbol_sum)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // inverse of rank, fills locs largest location first
+    // location_count is the number of remaining locations when the symbol was encoded
+    static void unrank(Word symbol_sum, uint64_t count, uint64_t location_count, size_t* locs) {
+        uint64_t upper_loc = location_count;
+        for(; count > 0; count--) {
+            // largest loc in [count-1, upper_loc) with (loc choose count) <= sum,
+            // count-1 choose count is 0 so the lower end always qualifies
+            uint64_t lo = count - 1;
+            uint64_t hi = upper_loc;
+            while(hi - lo > 1) {
+                uint64_t mid = lo + (hi - lo)/2;
+                Word term;
+                if(binomial(mid, count, term) && term <= symbol_sum) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            Word term;
+            binomial(lo, count, term);
+            symbol_sum -= term;
+            locs[count - 1] = lo;
+            upper_loc = lo;
+        }
+    }
+
+    // digit[0] + radix[0]*(digit[1] + radix[1]*(digit[2] + ...)), the same value ProductTree::combine builds
+    static Word combine(std::vector<Word>& digits, std::vector<Word>& symbol_radices) {
+        if(digits.empty()) {
+            return 0;
+        }
+        Word value = digits.back();
+        for(size_t digit_idx = digits.size() - 1; digit_idx > 0; digit_idx--) {
+            value = value * symbol_radices[digit_idx - 1] + digits[digit_idx - 1];
+        }
+        return value;
+    }
+
+    // inverse of combine, the last digit takes whatever remains like ProductTree::split
+    static void split(Word value, std::vector<Word>& symbol_radices, std::vector<Word>& digits) {
+        digits.resize(symbol_radices.size());
+        for(size_t digit_idx = 0; digit_idx + 1 < digits.size(); digit_idx++) {
+            digits[digit_idx] = value % symbol_radices[digit_idx];
+            value /= symbol_radices[digit_idx];
+        }
+        if(!digits.empty()) {
+            digits.back() = value;
+        }
+    }
+
+    // same bytes as mpz_export(order 1, size 1, endian -1): most significant first, no leading zeros
+    static void toPayload(Word value, std::vector<unsigned char>& payload) {
+        payload.clear();
+        for(; value; value >>= 8) {
+            payload.push_back((unsigned char)value);
+        }
+        std::reverse(payload.begin(), payload.end());
+    }
+
+    // false if the payload has more bytes than a Word
+    static bool fromPayload(const unsigned char* payload, size_t payload_size, Word& value) {
+        if(payload_size > sizeof(Word)) {
+            return false;
+        }
+        value = 0;
+        for(size_t i = 0; i < payload_size; i++) {
+            value = (value << 8) | payload[i];
+        }
+        return true;
+    }
+
+    // bits needed for value, 1 for 0 like mpz_sizeinbase
+    static size_t bitLength(Word value) {
+        size_t bits = 1;
+        while(value >>= 1) {
+            bits++;
+        }
+        return bits;
+    }
+
+    // decimal string for the verbose output, printf has no 128 bit format
+    static std::string toString(Word value) {
+        std::string digits;
+        do {
+            digits.push_back('0' + (char)(value % 10));
+            value /= 10;
+        } while(value);
+        std::reverse(digits.begin(), digits.end());
+        return digits;
+    }
+};
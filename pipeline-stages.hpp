@@ -0,0 +1,373 @@
+// Pre-transform pipeline, stages a block's bytes go through before frequency counting
+// (VLI_FLAG_STAGES) and the decoder undoes after placing the symbols, see block-container.hpp.
+// Valli coding is optimal for a block's symbol counts but blind to their order.  The stages turn
+// order into counts: the Burrows-Wheeler transform sorts the bytes by what follows them so equal
+// bytes cluster, move to front turns the clusters into zeros and small ranks, and zero run coding
+// shortens the runs of zeros.  The result is heavily skewed toward a few symbols, where the coder
+// does best (see the sparse corpora), and its most frequent symbol is the one that isn't coded,
+// so the bignum work shrinks with it.
+// Every stage has the same interface:
+//   id, its VLI_STAGE_* bit, and has_parameter, whether the block stores a value for its inverse
+//   forward(in, size, out, parameter)             out receives the transformed bytes
+//   inverse(in, size, parameter, out, out_size)   out receives the out_size bytes in was made from,
+//                                                 returns false if in can't be a transform of them
+// StagePipeline runs the stages a block's mask selects in VLI_STAGE_* order, and back in reverse.
+// All of them work on bytes, blocks of wider symbols are never transformed.
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>      // memcpy, memmove
+#include <algorithm>    // max
+
+#include "block-container.hpp" // VLI_STAGE_*
+
+// Burrows-Wheeler transform over the suffix array of the block
+// The rows are the block's suffixes followed by an end marker smaller than any byte, sorted, and
+// each row's byte is the one before its suffix.  The end marker's own row is left out and its
+// index is the parameter, so the output has the block's length.
+struct BwtStage {
+    static const uint8_t id = VLI_STAGE_BWT;
+    static const bool has_parameter = true;
+
+    void forward(const uint8_t* in, size_t size, std::vector<uint8_t>& out, uint64_t& row) {
+        out.resize(size);
+        row = 0;
+        if(size == 0) {
+            return;
+        }
+        suffixArray(in, size);
+        // row 0 is the empty suffix (the end marker alone), preceded by the last byte
+        out[0] = in[size - 1];
+        size_t out_idx = 1;
+        for(size_t i = 0; i < size; i++) {
+            if(sa[i] == 0) {
+                // the whole block, preceded by the end marker
+                row = i + 1;
+            } else {
+                out[out_idx++] = in[sa[i] - 1];
+            }
+        }
+    }
+
+    // walks the rows backwards from the end marker's, each row's byte is the one before it
+    bool inverse(const uint8_t* in, size_t size, uint64_t row, std::vector<uint8_t>& out, size_t out_size) {
+        if(size != out_size || (size ? row == 0 || row > size : row != 0)) {
+            return false;
+        }
+        out.resize(size);
+        // rank of each byte among the equal bytes before it, and the first row of each byte value
+        // (rows start at 1, after the end marker's row 0)
+        ranks.resize(size);
+        uint64_t seen[256] = {0};
+        for(size_t i = 0; i < size; i++) {
+            ranks[i] = seen[in[i]]++;
+        }
+        uint64_t first_row[256];
+        uint64_t next_row = 1;
+        for(int c = 0; c < 256; c++) {
+            first_row[c] = next_row;
+            next_row += seen[c];
+        }
+        // row r's byte is in[r] before the left out row and in[r-1] after it, every row stays in bounds
+        // even in a corrupt block
+        uint64_t r = 0;
+        for(size_t i = size; i-- > 0;) {
+            size_t in_idx = r < row ? r : r - 1;
+            out[i] = in[in_idx];
+            r = first_row[in[in_idx]] + ranks[in_idx];
+        }
+        return true;
+    }
+
+  private:
+    // scratch kept between blocks
+    std::vector<uint32_t> sa;
+    std::vector<uint32_t> ranks;
+    std::vector<uint32_t> scratch;
+    std::vector<uint32_t> counts;
+
+    // Suffixes sorted by prefix doubling: sorted by their first 2k bytes from the order by the first
+    // k, with two stable counting sorts per round, O(n log n).  A suffix that ends within the
+    // compared bytes sorts before the longer ones it is a prefix of, as if followed by the end marker.
+    void suffixArray(const uint8_t* in, size_t size) {
+        sa.resize(size);
+        ranks.resize(size);
+        scratch.resize(size);
+        // by the first byte
+        counts.assign(std::max<size_t>(256, size) + 1, 0);
+        for(size_t i = 0; i < size; i++) {
+            counts[in[i] + 1]++;
+        }
+        for(size_t c = 0; c < 256; c++) {
+            counts[c + 1] += counts[c];
+        }
+        for(size_t i = 0; i < size; i++) {
+            sa[counts[in[i]]++] = i;
+            ranks[i] = in[i];
+        }
+        size_t classes = 256;
+        for(size_t k = 1; ; k <<= 1) {
+            // by the second k bytes: the suffixes ending within them first, then in the current order
+            size_t sorted = 0;
+            for(size_t i = size - std::min(k, size); i < size; i++) {
+                scratch[sorted++] = i;
+            }
+            for(size_t i = 0; i < size; i++) {
+                if(sa[i] >= k) {
+                    scratch[sorted++] = sa[i] - k;
+                }
+            }
+            // then stable by the first k bytes
+            std::fill(counts.begin(), counts.begin() + classes + 1, 0);
+            for(size_t i = 0; i < size; i++) {
+                counts[ranks[i] + 1]++;
+            }
+            for(size_t c = 0; c < classes; c++) {
+                counts[c + 1] += counts[c];
+            }
+            for(size_t i = 0; i < size; i++) {
+                sa[counts[ranks[scratch[i]]]++] = scratch[i];
+            }
+            // ranks by the first 2k bytes
+            scratch[sa[0]] = 0;
+            classes = 1;
+            for(size_t i = 1; i < size; i++) {
+                size_t a = sa[i - 1], b = sa[i];
+                bool same = ranks[a] == ranks[b] && a + k < size && b + k < size && ranks[a + k] == ranks[b + k];
+                if(!same) {
+                    classes++;
+                }
+                scratch[b] = classes - 1;
+            }
+            ranks.swap(scratch);
+            if(classes == size) {
+                break;
+            }
+        }
+    }
+};
+
+// Move to front: every byte becomes the number of distinct bytes seen since its last occurrence,
+// so the clusters the BWT makes become zeros and small ranks
+struct MoveToFrontStage {
+    static const uint8_t id = VLI_STAGE_MTF;
+    static const bool has_parameter = false;
+
+    void forward(const uint8_t* in, size_t size, std::vector<uint8_t>& out, uint64_t&) {
+        out.resize(size);
+        uint8_t order[256];
+        for(int c = 0; c < 256; c++) {
+            order[c] = c;
+        }
+        for(size_t i = 0; i < size; i++) {
+            uint8_t symbol = in[i];
+            uint8_t rank = 0;
+            while(order[rank] != symbol) {
+                rank++;
+            }
+            memmove(order + 1, order, rank);
+            order[0] = symbol;
+            out[i] = rank;
+        }
+    }
+
+    bool inverse(const uint8_t* in, size_t size, uint64_t, std::vector<uint8_t>& out, size_t out_size) {
+        if(size != out_size) {
+            return false;
+        }
+        out.resize(size);
+        uint8_t order[256];
+        for(int c = 0; c < 256; c++) {
+            order[c] = c;
+        }
+        for(size_t i = 0; i < size; i++) {
+            uint8_t rank = in[i];
+            uint8_t symbol = order[rank];
+            memmove(order + 1, order, rank);
+            order[0] = symbol;
+            out[i] = symbol;
+        }
+        return true;
+    }
+};
+
+// Zero run coding (bzip2's RUNA/RUNB): a run of zeros becomes its length in bijective base 2,
+// least significant digit first, 0 for a digit of 1 and 1 for a digit of 2, so a run of n zeros
+// takes about log2(n) bytes.  Other bytes move up by one to make room, 254 and 255 don't fit and
+// become 255 followed by 0 or 1.  Only bytes of 254 and 255 grow, at most doubling the length.
+struct ZeroRunStage {
+    static const uint8_t id = VLI_STAGE_ZERO_RUN;
+    static const bool has_parameter = false;
+
+    void forward(const uint8_t* in, size_t size, std::vector<uint8_t>& out, uint64_t&) {
+        out.clear();
+        uint64_t run = 0;
+        for(size_t i = 0; i < size; i++) {
+            uint8_t symbol = in[i];
+            if(symbol == 0) {
+                run++;
+                continue;
+            }
+            writeRun(run, out);
+            run = 0;
+            if(symbol < 254) {
+                out.push_back(symbol + 1);
+            } else {
+                out.push_back(255);
+                out.push_back(symbol - 254);
+            }
+        }
+        writeRun(run, out);
+    }
+
+    bool inverse(const uint8_t* in, size_t size, uint64_t, std::vector<uint8_t>& out, size_t out_size) {
+        out.clear();
+        out.reserve(out_size);
+        uint64_t run = 0;
+        uint64_t digit_weight = 1;
+        for(size_t i = 0; i < size; i++) {
+            uint8_t symbol = in[i];
+            if(symbol <= 1) {
+                // a run never exceeds the output, which also keeps the weight from overflowing
+                if(digit_weight > out_size) {
+                    return false;
+                }
+                run += (symbol + 1) * digit_weight;
+                digit_weight <<= 1;
+                continue;
+            }
+            if(run > out_size - out.size()) {
+                return false;
+            }
+            out.insert(out.end(), run, 0);
+            run = 0;
+            digit_weight = 1;
+            if(symbol < 255) {
+                out.push_back(symbol - 1);
+            } else {
+                if(i + 1 == size || in[i + 1] > 1) {
+                    return false;
+                }
+                out.push_back(254 + in[++i]);
+            }
+            if(out.size() > out_size) {
+                return false;
+            }
+        }
+        if(run > out_size - out.size()) {
+            return false;
+        }
+        out.insert(out.end(), run, 0);
+        return out.size() == out_size;
+    }
+
+  private:
+    static void writeRun(uint64_t run, std::vector<uint8_t>& out) {
+        while(run > 0) {
+            if(run & 1) {
+                out.push_back(0);
+                run = (run - 1) / 2;
+            } else {
+                out.push_back(1);
+                run = (run - 2) / 2;
+            }
+        }
+    }
+};
+
+// The stages in order, with the buffers between them
+struct StagePipeline {
+    // block parameters of the stages in mask stages
+    static size_t parameterCount(uint8_t stages) {
+        return ((stages & BwtStage::id) && BwtStage::has_parameter)
+               + ((stages & MoveToFrontStage::id) && MoveToFrontStage::has_parameter)
+               + ((stages & ZeroRunStage::id) && ZeroRunStage::has_parameter);
+    }
+
+    // names of the stages in mask stages, for verbose output
+    static std::string names(uint8_t stages) {
+        std::string text;
+        const char* stage_names[] = {"BWT", "move to front", "zero runs"};
+        for(int stage = 0; stage < 3; stage++) {
+            if(stages & (1 << stage)) {
+                text += (text.empty() ? "" : " + ") + std::string(stage_names[stage]);
+            }
+        }
+        return text.empty() ? "none" : text;
+    }
+
+    // transformed length of a block of size bytes is at most this, the zero run stage can double it
+    static uint64_t maxStagedSize(uint64_t size) {
+        return 2 * size;
+    }
+
+    // Apply the stages in mask stages to the size bytes of block, parameters receives the
+    // parameters of the stages that have one, in order.  Returns the transformed bytes, valid
+    // until the next call.
+    const std::vector<uint8_t>& forward(uint8_t stages, const uint8_t* block, size_t size, std::vector<uint64_t>& parameters) {
+        parameters.clear();
+        buffers[0].assign(block, block + size);
+        size_t current = 0;
+        forwardStage(bwt, stages, current, parameters);
+        forwardStage(mtf, stages, current, parameters);
+        forwardStage(zero_run, stages, current, parameters);
+        return buffers[current];
+    }
+
+    // Undo forward: output receives the output_size bytes of the block staged (size bytes) was made
+    // from, parameters as forward gave them
+    // returns false if the parameters or the transformed bytes can't come from such a block
+    bool inverse(uint8_t stages, const uint8_t* staged, size_t size, const std::vector<uint64_t>& parameters, uint8_t* output, size_t output_size) {
+        size_t parameter_count = parameterCount(stages);
+        if(parameter_count != parameters.size()) {
+            return false;
+        }
+        buffers[0].assign(staged, staged + size);
+        size_t current = 0;
+        if(!inverseStage(zero_run, stages, current, parameters, parameter_count, output_size)
+           || !inverseStage(mtf, stages, current, parameters, parameter_count, output_size)
+           || !inverseStage(bwt, stages, current, parameters, parameter_count, output_size)
+           || buffers[current].size() != output_size) {
+            return false;
+        }
+        memcpy(output, buffers[current].data(), output_size);
+        return true;
+    }
+
+  private:
+    BwtStage bwt;
+    MoveToFrontStage mtf;
+    ZeroRunStage zero_run;
+    // each stage reads buffers[current] and writes the other one
+    std::vector<uint8_t> buffers[2];
+
+    template<typename Stage>
+    void forwardStage(Stage& stage, uint8_t stages, size_t& current, std::vector<uint64_t>& parameters) {
+        if(!(stages & Stage::id)) {
+            return;
+        }
+        uint64_t parameter = 0;
+        stage.forward(buffers[current].data(), buffers[current].size(), buffers[1 - current], parameter);
+        if(Stage::has_parameter) {
+            parameters.push_back(parameter);
+        }
+        current = 1 - current;
+    }
+
+    // parameter_count counts down, the stages are undone last to first
+    template<typename Stage>
+    bool inverseStage(Stage& stage, uint8_t stages, size_t& current, const std::vector<uint64_t>& parameters, size_t& parameter_count, size_t output_size) {
+        if(!(stages & Stage::id)) {
+            return true;
+        }
+        uint64_t parameter = Stage::has_parameter ? parameters[--parameter_count] : 0;
+        if(!stage.inverse(buffers[current].data(), buffers[current].size(), parameter, buffers[1 - current], output_size)) {
+            return false;
+        }
+        current = 1 - current;
+        return true;
+    }
+};
@@ -0,0 +1,651 @@
+// Valli Benchmark - throughput, size and regression checks
+// clang++ -std=c++17 -O2 -pthread poc-benchmark.cpp libvalli.cpp -lgmp -o poc-benchmark
+// Usage: poc-benchmark [--baseline <file>] [--update] [--tolerance <fraction>] [--threads <count>]
+// Run from the repository root so testfiles/ is found.
+//
+// Compresses and decompresses every file in testfiles/ plus generated corpora (skewed, uniform,
+// sparse, large alphabet and binary using all 256 byte values at a few sizes, 16 bit text and
+// 32 bit tokens), checks the round trip and reports for each:
+//     size vs the static Shannon bound, MB/s and ns/symbol both ways, peak RSS
+// followed by microbenchmarks of the building blocks (binomials, ranking and unranking a symbol,
+// frequency table serialization), and a check that a range read of a whole message takes no more
+// GMP arena memory than a read within one block, and the same for locating a symbol, and that
+// damaged containers given to the C interface's multi-threaded decoder fail with a status.
+// Results are compared with the stored baseline (benchmark-baseline.txt): any corpus getting
+// larger, or a speed dropping by more than the tolerance (default 30%) in 3 runs, is reported
+// and the exit code is 1.  --update writes the current results as the new baseline instead.
+// Speeds depend on the machine, regenerate the baseline with --update when moving to a new one.
+// The encoded sizes don't, they must match exactly on any machine.
+
+#include <iostream>     // cout
+#include <fstream>      // baseline file
+#include <iomanip>      // setw, setprecision
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <algorithm>    // sort, min, max
+#include <math.h>       // log2, pow, ceil
+#include <dirent.h>     // opendir, readdir
+#include <sys/resource.h>  // getrusage
+
+#include "valli.h"
+#include "valli.hpp"
+#include "gmp-arena.hpp"
+#include "mapped-file.hpp"
+
+
+using namespace std;
+
+// Deterministic pseudo random numbers (xorshift64*), the generated corpora are the same on every run
+struct BenchmarkRandom {
+    uint64_t state;
+    explicit BenchmarkRandom(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+    // uniform in [0, 1)
+    double unit() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// symbol i has weight weights[i], symbols are first_symbol, first_symbol+1, ...
+// size symbols of symbol_bytes each, little endian
+string generate_corpus(size_t size, vector<double> weights, uint32_t first_symbol, uint64_t seed, int symbol_bytes = 1) {
+    BenchmarkRandom random(seed);
+    vector<double> cumulative(weights.size());
+    double sum = 0;
+    for(size_t i = 0; i < weights.size(); i++) {
+        sum += weights[i];
+        cumulative[i] = sum;
+    }
+    string corpus(size * symbol_bytes, '\0');
+    for(size_t i = 0; i < size; i++) {
+        double pick = random.unit() * sum;
+        size_t symbol = lower_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+        uint32_t value = first_symbol + min(symbol, weights.size() - 1);
+        for(int b = 0; b < symbol_bytes; b++) {
+            corpus[i * symbol_bytes + b] = (char)(value >> (8 * b));
+        }
+    }
+    return corpus;
+}
+
+// weight 1/(i+1)^exponent for i < symbols, exponent 0 is uniform
+vector<double> zipf_weights(size_t symbols, double exponent) {
+    vector<double> weights(symbols);
+    for(size_t i = 0; i < symbols; i++) {
+        weights[i] = 1.0 / pow(i + 1.0, exponent);
+    }
+    return weights;
+}
+
+struct Corpus {
+    string name;
+    string data;
+    int symbol_bytes = 1;
+    // coded with the alphabet partition tree (ValliEncoder::wavelet)
+    bool wavelet = false;
+    // blocks may pick order 1 context streams (ValliEncoder::contexts)
+    bool contexts = false;
+    // blocks may go through the BWT, move to front and zero run stages (ValliEncoder::stages)
+    bool stages = false;
+};
+
+vector<Corpus> load_corpora() {
+    vector<Corpus> corpora;
+    // bundled files, sorted so the order doesn't depend on the filesystem
+    vector<string> names;
+    if(DIR* dir = opendir("testfiles")) {
+        while(dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            if(name[0] != '.' && name.find('.') == string::npos) {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    sort(names.begin(), names.end());
+    for(string& name : names) {
+        MappedInputFile file;
+        if(file.open("testfiles/" + name) && file.size > 0) {
+            corpora.push_back({name, string((const char*)file.data, file.size)});
+        }
+    }
+    if(corpora.empty()) {
+        cout << "Note: testfiles/ not found, run from the repository root to include the bundled files." << endl;
+    }
+
+    // generated: text like skew, uniform bytes, mostly one symbol, all but one byte value, and binary using every byte value
+    size_t sizes[] = {1000, 64000, 256000};
+    const char* size_names[] = {"1k", "64k", "256k"};
+    for(int s = 0; s < 3; s++) {
+        corpora.push_back({string("skewed_") + size_names[s], generate_corpus(sizes[s], zipf_weights(40, 1.1), 'a' - 8, 1 + s)});
+        corpora.push_back({string("uniform_") + size_names[s], generate_corpus(sizes[s], zipf_weights(64, 0.0), '0', 11 + s)});
+        corpora.push_back({string("sparse_") + size_names[s], generate_corpus(sizes[s], {1000, 1, 1, 1}, 'a', 21 + s)});
+        corpora.push_back({string("alphabet_") + size_names[s], generate_corpus(sizes[s], zipf_weights(255, 0.6), 1, 31 + s)});
+        corpora.push_back({string("binary_") + size_names[s], generate_corpus(sizes[s], zipf_weights(256, 0.3), 0, 51 + s)});
+    }
+    // wider symbols: 16 bit text (Cyrillic block of UTF-16) and 32 bit token ids, 64000 bytes each
+    corpora.push_back({"utf16_64k", generate_corpus(32000, zipf_weights(120, 1.0), 0x0400, 41, 2), 2});
+    corpora.push_back({"tokens_64k", generate_corpus(16000, zipf_weights(2000, 1.0), 0x10000, 42, 4), 4});
+    // the alphabet partition tree on a small and a large alphabet, same sizes as above
+    corpora.push_back({"skewed_64k_wt", generate_corpus(64000, zipf_weights(40, 1.1), 'a' - 8, 2), 1, true});
+    corpora.push_back({"alphabet_64k_wt", generate_corpus(64000, zipf_weights(255, 0.6), 1, 32), 1, true});
+    // context streams on English text (wizard_of_oz repeated to a full block) where they pay off,
+    // and on independent symbols where the block falls back to order 0
+    for(Corpus& corpus : corpora) {
+        if(corpus.name == "wizard_of_oz") {
+            string text;
+            while(text.size() < 64000) {
+                text += corpus.data;
+            }
+            text.resize(64000);
+            corpora.push_back({"text_64k", text});
+            corpora.push_back({"text_64k_ctx", text, 1, false, true});
+            corpora.push_back({"text_64k_bwt", text, 1, false, false, true});
+            break;
+        }
+    }
+    corpora.push_back({"skewed_64k_ctx", generate_corpus(64000, zipf_weights(40, 1.1), 'a' - 8, 2), 1, false, true});
+    corpora.push_back({"skewed_64k_bwt", generate_corpus(64000, zipf_weights(40, 1.1), 'a' - 8, 2), 1, false, false, true});
+    return corpora;
+}
+
+// best time of one call in nanoseconds, repeated at least 3 times and for min_seconds
+// every call starts from the same arena state, the GMP arenas rewind once a block's bignums are gone
+double best_nanoseconds(const function<void()>& run, double min_seconds = 0.2) {
+    double best = 1e300;
+    double elapsed_total = 0;
+    for(int repeat = 0; repeat < 3 || elapsed_total < min_seconds * 1e9; repeat++) {
+        auto start = chrono::steady_clock::now();
+        run();
+        double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        best = min(best, elapsed);
+        elapsed_total += elapsed;
+    }
+    return best;
+}
+
+// peak resident set size of the process so far, in MB
+double peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// sum over the blocks of the static Shannon limit, in bits
+double shannon_bits(const string& data, uint64_t block_size, int symbol_bytes = 1) {
+    double bits = 0;
+    for(uint64_t offset = 0; offset < data.size(); offset += block_size) {
+        uint64_t length = min<uint64_t>(block_size, data.size() - offset) / symbol_bytes;
+        map<uint32_t, uint64_t> counts;
+        for(uint64_t i = 0; i < length; i++) {
+            uint32_t symbol = 0;
+            for(int b = 0; b < symbol_bytes; b++) {
+                symbol |= (uint32_t)(unsigned char)data[offset + i * symbol_bytes + b] << (8 * b);
+            }
+            counts[symbol]++;
+        }
+        double entropy = 0;
+        for(auto& count : counts) {
+            double probability = (double)count.second / length;
+            entropy -= probability * log2(probability);
+        }
+        bits += ceil(entropy * length);
+    }
+    return bits;
+}
+
+// Results are name -> value, names are "<corpus>.<metric>" or "micro.<benchmark>.<metric>"
+// Metric suffixes say which direction is a regression.
+//     .bytes     exact, any increase fails
+//     .mbs       higher is better, fails below baseline * (1 - tolerance)
+//     .ns        lower is better, fails above baseline * (1 + tolerance)
+typedef map<string, double> BenchmarkResults;
+
+bool load_baseline(const string& path, BenchmarkResults& baseline) {
+    ifstream in(path);
+    if(!in) {
+        return false;
+    }
+    string line;
+    while(getline(in, line)) {
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        string name;
+        double value;
+        if(fields >> name >> value) {
+            baseline[name] = value;
+        }
+    }
+    return true;
+}
+
+bool save_baseline(const string& path, BenchmarkResults& results) {
+    ofstream out(path);
+    out << "# poc-benchmark baseline, regenerate with: poc-benchmark --update" << endl;
+    out << "# .bytes must match exactly, .mbs and .ns are checked against --tolerance" << endl;
+    for(auto& result : results) {
+        out << result.first << " " << setprecision(10) << result.second << endl;
+    }
+    return (bool)out;
+}
+
+bool ends_with(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// returns the number of regressions, printed when report is set
+int compare_to_baseline(BenchmarkResults& results, BenchmarkResults& baseline, double tolerance, bool report) {
+    int regressions = 0;
+    for(auto& result : results) {
+        auto base = baseline.find(result.first);
+        if(base == baseline.end()) {
+            continue;
+        }
+        double current = result.second;
+        double expected = base->second;
+        bool regressed = false;
+        if(ends_with(result.first, ".bytes")) {
+            regressed = current > expected;
+        } else if(ends_with(result.first, ".mbs")) {
+            regressed = current < expected * (1 - tolerance);
+        } else if(ends_with(result.first, ".ns")) {
+            regressed = current > expected * (1 + tolerance);
+        }
+        if(regressed && report) {
+            cout << "REGRESSION " << result.first << ": " << current << " (baseline " << expected << ")" << endl;
+        }
+        regressions += regressed;
+    }
+    for(auto& base : baseline) {
+        if(report && results.find(base.first) == results.end()) {
+            cout << "Missing from this run: " << base.first << endl;
+        }
+    }
+    return regressions;
+}
+
+// keep the best speed of each metric over several runs, sizes are the same every run
+void keep_best(BenchmarkResults& results, BenchmarkResults& again) {
+    for(auto& result : again) {
+        double& best = results[result.first];
+        if(ends_with(result.first, ".mbs")) {
+            best = max(best, result.second);
+        } else if(ends_with(result.first, ".ns")) {
+            best = min(best, result.second);
+        }
+    }
+}
+
+// compress, decompress and verify every corpus
+bool run_corpora(vector<Corpus>& corpora, size_t thread_count, BenchmarkResults& results) {
+    ValliDecoder decoder(thread_count);
+    cout << left << setw(16) << "corpus" << right << setw(10) << "bytes" << setw(10) << "encoded" << setw(8) << "ratio"
+         << setw(10) << "/shannon" << setw(10) << "enc MB/s" << setw(10) << "dec MB/s" << setw(12) << "enc ns/sym"
+         << setw(12) << "dec ns/sym" << setw(10) << "RSS MB" << endl;
+    cout << fixed;
+    for(Corpus& corpus : corpora) {
+        ValliEncoder encoder(VLI_DEFAULT_BLOCK_SIZE, thread_count, corpus.symbol_bytes);
+        encoder.wavelet = corpus.wavelet;
+        encoder.contexts = corpus.contexts;
+        encoder.stages = corpus.stages ? VLI_STAGE_BWT | VLI_STAGE_MTF | VLI_STAGE_ZERO_RUN : 0;
+        vector<unsigned char> encoded(ValliEncoder::maxEncodedSize(corpus.data.size(), encoder.blockSize(), corpus.symbol_bytes));
+        string decoded(corpus.data.size(), '\0');
+        size_t encoded_size = 0;
+        size_t decoded_size = 0;
+        valli_status status = VALLI_OK;
+        double encode_ns = best_nanoseconds([&] {
+            status = encoder.encode(corpus.data.data(), corpus.data.size(), encoded.data(), encoded.size(), &encoded_size);
+        });
+        if(status != VALLI_OK) {
+            cout << corpus.name << ": encode failed (" << status << ")" << endl;
+            return false;
+        }
+        double decode_ns = best_nanoseconds([&] {
+            status = decoder.decode(encoded.data(), encoded_size, &decoded[0], decoded.size(), &decoded_size);
+        });
+        if(status != VALLI_OK || decoded_size != corpus.data.size() || decoded != corpus.data) {
+            cout << corpus.name << ": round trip failed (" << status << ")" << endl;
+            return false;
+        }
+
+        double bytes = corpus.data.size();
+        double shannon_bytes = shannon_bits(corpus.data, encoder.blockSize(), corpus.symbol_bytes) / 8;
+        double encode_mbs = bytes / encode_ns * 1e3;
+        double decode_mbs = bytes / decode_ns * 1e3;
+        cout << left << setw(16) << corpus.name << right << setw(10) << corpus.data.size() << setw(10) << encoded_size
+             << setprecision(1) << setw(7) << 100.0 * encoded_size / bytes << "%"
+             << setw(9) << (shannon_bytes > 0 ? 100.0 * encoded_size / shannon_bytes : 0.0) << "%"
+             << setprecision(2) << setw(10) << encode_mbs << setw(10) << decode_mbs
+             << setprecision(1) << setw(12) << encode_ns / bytes << setw(12) << decode_ns / bytes
+             << setw(10) << peak_rss_mb() << endl;
+        results[corpus.name + ".encoded.bytes"] = encoded_size;
+        results[corpus.name + ".encode.mbs"] = encode_mbs;
+        results[corpus.name + ".decode.mbs"] = decode_mbs;
+    }
+    return true;
+}
+
+// peak GMP arena bytes of all threads during run
+size_t peak_arena_bytes(const function<void()>& run) {
+    // starts the block statistics over, block_peak_bytes then covers just this call
+    gmp_arena_rewind();
+    run();
+    return gmp_arena_stats().block_peak_bytes;
+}
+
+// Reading more blocks must not take more GMP memory than reading one: every block's bignums
+// are cleared before the next one, so the arenas start over.  A range covering the whole
+// message is compared with a range within one block, and locate over the whole message with
+// locate in its first block.  Prints the failures and returns false.
+bool check_arena_growth(size_t thread_count) {
+    const uint64_t block_size = 16000;
+    string data = generate_corpus(80 * block_size, zipf_weights(40, 1.1), 'a' - 8, 61);
+    ValliEncoder encoder(block_size, thread_count);
+    encoder.block_index = true;
+    vector<unsigned char> encoded(ValliEncoder::maxEncodedSize(data.size(), block_size));
+    size_t encoded_size;
+    if(encoder.encode(data.data(), data.size(), encoded.data(), encoded.size(), &encoded_size) != VALLI_OK) {
+        cout << "arena check: encode failed" << endl;
+        return false;
+    }
+    ValliDecoder decoder(thread_count);
+    string decoded(data.size(), '\0');
+    size_t written;
+    bool ok = true;
+    // the limit leaves room for blocks that need a little more than the first
+    auto check = [&](const string& name, size_t one_block, size_t all_blocks) {
+        cout << "arena check " << name << ": one block " << one_block << " bytes, all blocks " << all_blocks << " bytes" << endl;
+        if(all_blocks > 2 * one_block) {
+            cout << "ARENA GROWTH " << name << ": peak grows with the number of blocks" << endl;
+            ok = false;
+        }
+    };
+    size_t range_one = peak_arena_bytes([&] {
+        decoder.decodeRange(encoded.data(), encoded_size, 100, 1000, &decoded[0], decoded.size(), &written);
+    });
+    valli_status status = VALLI_OK;
+    size_t range_all = peak_arena_bytes([&] {
+        status = decoder.decodeRange(encoded.data(), encoded_size, 0, data.size(), &decoded[0], decoded.size(), &written);
+    });
+    if(status != VALLI_OK || decoded != data) {
+        cout << "arena check: range round trip failed (" << status << ")" << endl;
+        return false;
+    }
+    check("range", range_one, range_all);
+
+    // locate walks every block, compared with the same message cut to its first block
+    vector<unsigned char> first_block(ValliEncoder::maxEncodedSize(block_size, block_size));
+    size_t first_block_size;
+    if(encoder.encode(data.data(), block_size, first_block.data(), first_block.size(), &first_block_size) != VALLI_OK) {
+        cout << "arena check: encode failed" << endl;
+        return false;
+    }
+    // a symbol in the middle of the block's order, so the value is split and half of it unranked
+    const uint32_t symbol = 'a' - 8 + 10;
+    vector<uint64_t> positions;
+    size_t locate_one = peak_arena_bytes([&] {
+        positions.clear();
+        decoder.locate(first_block.data(), first_block_size, symbol, positions);
+    });
+    size_t locate_all = peak_arena_bytes([&] {
+        positions.clear();
+        status = decoder.locate(encoded.data(), encoded_size, symbol, positions);
+    });
+    if(status != VALLI_OK || positions.size() != (size_t)count(data.begin(), data.end(), (char)symbol)) {
+        cout << "arena check: locate failed (" << status << ")" << endl;
+        return false;
+    }
+    check("locate", locate_one, locate_all);
+    return ok;
+}
+
+// Damaged containers through the C interface with a multi-threaded decoder: every call must come
+// back with a status, whatever a pool thread or an allocation runs into (a crash or an exception
+// escaping into C ends the benchmark).  Bytes are flipped in containers of every coding and the
+// header's sizes made huge.  Prints the failures and returns false.
+bool check_c_api_corrupt() {
+    const uint64_t block_size = 4000;
+    string data = generate_corpus(16000, zipf_weights(40, 1.1), 'a' - 8, 71);
+    valli_decoder* decoder = valli_decoder_new(4);
+    if(!decoder) {
+        cout << "C API check: no decoder" << endl;
+        return false;
+    }
+    BenchmarkRandom random(72);
+    vector<char> output(data.size());
+    vector<uint64_t> positions(data.size());
+    size_t rejected = 0, decoded = 0;
+    bool ok = true;
+    for(int mode = 0; mode < 5 && ok; mode++) {
+        valli_encoder* encoder = valli_encoder_new(block_size, 4);
+        valli_encoder_set_block_index(encoder, mode == 1);
+        valli_encoder_set_wavelet(encoder, mode == 2);
+        valli_encoder_set_contexts(encoder, mode == 3);
+        valli_encoder_set_stages(encoder, mode == 4 ? VALLI_STAGE_BWT | VALLI_STAGE_MTF | VALLI_STAGE_ZERO_RUN : 0);
+        vector<unsigned char> encoded(valli_encoder_max_encoded_size(encoder, data.size()));
+        size_t encoded_size;
+        valli_status status = valli_encode(encoder, data.data(), data.size(), encoded.data(), encoded.size(), &encoded_size);
+        valli_encoder_free(encoder);
+        if(status != VALLI_OK) {
+            cout << "C API check: encode failed (" << status << ")" << endl;
+            ok = false;
+            break;
+        }
+        encoded.resize(encoded_size);
+        for(int variant = 0; variant < 40; variant++) {
+            vector<unsigned char> damaged = encoded;
+            for(int flips = 1 + random.next() % 4; flips > 0; flips--) {
+                damaged[random.next() % damaged.size()] ^= 1 << (random.next() % 8);
+            }
+            if(variant % 10 == 0) {
+                damaged.resize(random.next() % damaged.size());
+            }
+            size_t written, found;
+            uint64_t occurrences;
+            status = valli_decode(decoder, damaged.data(), damaged.size(), output.data(), output.size(), &written);
+            status != VALLI_OK ? rejected++ : decoded++;
+            valli_decode_range(decoder, damaged.data(), damaged.size(), 5000, 6000, output.data(), output.size(), &written);
+            valli_locate(decoder, damaged.data(), damaged.size(), 'a', positions.data(), positions.size(), &found);
+            valli_count(decoder, damaged.data(), damaged.size(), 'a', &occurrences, NULL);
+        }
+    }
+    // version 3 header: 2^20 blocks of 2^40 bytes in a few bytes, and one block of 2^44 bytes
+    // whose table says so, larger than any memory to decode it in
+    unsigned char huge_blocks[] = {'V', 'L', 'I', 3, 1, 0, 0x80, 0x80, 0x80, 0x80, 0x80, 0x20, 0x80, 0x80, 0x40,
+                                   0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x10, 0, 0, 0, 0};
+    unsigned char huge_block[64] = {'V', 'L', 'I', 3, 1, 0, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x04, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x04};
+    {
+        ByteWriter writer(huge_block + 21, sizeof(huge_block) - 21);
+        FreqChar freqs;
+        freqs.setChar(0, 'a');
+        freqs.setCount(0, (1ull << 44) - 1);
+        freqs.setChar(1, 'b');
+        freqs.setCount(1, 1);
+        freqs.sortData();
+        uint64_t table_bytes;
+        write_block(writer, freqs, vector<unsigned char>(5, 0x11), table_bytes);
+    }
+    size_t written;
+    uint64_t offsets[] = {0, 1ull << 20};
+    valli_status status = valli_decode_range(decoder, huge_blocks, sizeof(huge_blocks), 0, 16, output.data(), output.size(), &written);
+    if(status == VALLI_OK) {
+        cout << "C API check: header of 2^20 huge blocks accepted" << endl;
+        ok = false;
+    }
+    for(uint64_t offset : offsets) {
+        status = valli_decode_range(decoder, huge_block, sizeof(huge_block), offset, 16, output.data(), output.size(), &written);
+        if(status == VALLI_OK) {
+            cout << "C API check: block of 2^44 bytes decoded" << endl;
+            ok = false;
+        }
+    }
+    valli_decoder_free(decoder);
+    cout << "C API check: " << rejected << " damaged containers rejected, " << decoded << " still decoded" << endl;
+    return ok;
+}
+
+// building blocks on a typical 64000 byte block
+void run_micro(BenchmarkResults& results) {
+    cout << endl << left << setw(36) << "microbenchmark" << right << setw(14) << "ns/op" << endl;
+    auto report = [&](const string& name, double nanoseconds) {
+        cout << left << setw(36) << name << right << setw(14) << setprecision(1) << nanoseconds << endl;
+        results["micro." + name + ".ns"] = nanoseconds;
+    };
+    const uint64_t block = 64000;
+    BenchmarkRandom random(7);
+    binomial_engine().prepare(block);
+
+    // values kept across calls live on the heap, the arenas can only rewind when nothing in them is live
+    const uint64_t count = 2000;
+    size_t radix_bits = binomial_bit_bound(block, count);
+    mpz_t value, symbol_sum, remaining_sum;
+    {
+        GmpArenaPause pause;
+        mpz_init2(value, binomial_bit_bound(block, block / 2));
+        mpz_init2(symbol_sum, radix_bits);
+        mpz_init2(remaining_sum, radix_bits);
+    }
+
+    // n choose k from scratch, a small, medium and large count
+    for(uint64_t k : {20, 2000, 20000}) {
+        report("binomial_64000_" + to_string(k), best_nanoseconds([&] {
+            binomial_engine().binomial(value, block, k, false);
+        }));
+    }
+
+    // one symbol with 2000 instances scattered over the block, per instance
+    vector<size_t> locs;
+    while(locs.size() < count) {
+        locs.push_back(random.next() % block);
+        sort(locs.begin(), locs.end());
+        locs.erase(unique(locs.begin(), locs.end()), locs.end());
+    }
+    report("rank_symbol_instance", best_nanoseconds([&] {
+        mpz_set_ui(symbol_sum, 0);
+        CombinationRanker ranker(radix_bits);
+        for(uint64_t instance = 0; instance < count; instance++) {
+            ranker.add(locs[instance], instance + 1, symbol_sum);
+        }
+    }) / count);
+
+    // the decoder's unranking loop on the same symbol, per instance
+    vector<size_t> decoded_locs(count);
+    report("unrank_symbol_instance", best_nanoseconds([&] {
+        mpz_set(remaining_sum, symbol_sum);
+        CombinationUnranker unranker(radix_bits);
+        unranker.reset(block);
+        for(uint64_t symbol_count = count; symbol_count > 0; symbol_count--) {
+            decoded_locs[symbol_count - 1] = unranker.next(remaining_sum, symbol_count);
+        }
+    }) / count);
+    if(decoded_locs != locs) {
+        cout << "unrank_symbol_instance: locations don't match" << endl;
+    }
+    mpz_clears(value, symbol_sum, remaining_sum, NULL);
+
+    // frequency table of a text block
+    string text = generate_corpus(block, zipf_weights(60, 1.0), ' ', 3);
+    FreqChar freqs;
+    CalcFrequencyPairs((const uint8_t*)text.data(), text.size(), freqs);
+    freqs.sortData();
+    unsigned char table[VLI_MAX_TABLE_BYTES];
+    size_t table_size = 0;
+    report("freq_table_serialize", best_nanoseconds([&] {
+        ByteWriter writer(table, sizeof(table));
+        freqs.serialize(writer);
+        table_size = writer.size;
+    }, 0.05));
+    FreqChar read_freqs;
+    report("freq_table_deserialize", best_nanoseconds([&] {
+        ByteReader reader(table, table_size);
+        read_freqs = FreqChar();
+        read_freqs.deserialize(reader);
+    }, 0.05));
+}
+
+int main(int argc, char* argv[]) {
+    // same allocator as the command line tools, must come before any mpz_init
+    gmp_arena_install();
+
+    string baseline_path = "benchmark-baseline.txt";
+    bool update = false;
+    double tolerance = 0.3;
+    // one thread by default, the speeds are the most repeatable
+    size_t thread_count = 1;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--update") {
+            update = true;
+        } else if(arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if(arg == "--tolerance" && i + 1 < argc) {
+            tolerance = strtod(argv[++i], NULL);
+        } else if(arg == "--threads" && i + 1 < argc) {
+            thread_count = strtoull(argv[++i], NULL, 10);
+        } else {
+            cout << "Usage: " << argv[0] << " [--baseline <file>] [--update] [--tolerance <fraction>] [--threads <count>]" << endl;
+            return 1;
+        }
+    }
+
+    vector<Corpus> corpora = load_corpora();
+    BenchmarkResults results;
+    if(!run_corpora(corpora, thread_count, results)) {
+        return 1;
+    }
+    run_micro(results);
+    cout << endl;
+    if(!check_arena_growth(thread_count) || !check_c_api_corrupt()) {
+        return 1;
+    }
+    cout << endl;
+
+    if(update) {
+        if(!save_baseline(baseline_path, results)) {
+            cout << "Error writing " << baseline_path << endl;
+            return 1;
+        }
+        cout << "Baseline written to " << baseline_path << endl;
+        return 0;
+    }
+    BenchmarkResults baseline;
+    if(!load_baseline(baseline_path, baseline)) {
+        cout << "No baseline at " << baseline_path << ", create one with --update" << endl;
+        return 0;
+    }
+    // Timings on a busy machine have outliers, so a regression is measured again before it is
+    // reported, up to max_runs runs in total keeping the best speed of each metric.
+    const int max_runs = 3;
+    int regressions = 0;
+    for(int run = 1; run <= max_runs; run++) {
+        regressions = compare_to_baseline(results, baseline, tolerance, run == max_runs);
+        if(!regressions || run == max_runs) {
+            break;
+        }
+        cout << regressions << " possible regression(s), measuring again" << endl << endl;
+        BenchmarkResults again;
+        if(!run_corpora(corpora, thread_count, again)) {
+            return 1;
+        }
+        run_micro(again);
+        cout << endl;
+        keep_best(results, again);
+    }
+    if(regressions) {
+        cout << regressions << " regression(s) against " << baseline_path << endl;
+        return 1;
+    }
+    cout << "No regressions against " << baseline_path << endl;
+    return 0;
+}
@@ -1,30 +1,91 @@
 // Valli Decompression - Proof of concept
-// clang++ -std=c++17 -O2 poc-decompress.cpp -lgmp -o poc-decompress
+// clang++ -std=c++17 -O2 -pthread poc-decompress.cpp -lgmp -o poc-decompress
+// Usage: poc-decompress [--range <offset> <length> | --count <symbol> | --locate <symbol>] <file.vli> [threads]
+// --range decodes only length bytes from offset into <file>.range, the blocks covering it are found
+// through the block index of files written with poc-compress --index, or by skipping the blocks before.
+// --count prints the occurrences of a symbol from the frequency tables, --locate also prints the
+// byte offset of each one, decoding every block only as far as that symbol.  The symbol is a number
+// (0x prefix for hex, a 16/32 bit value for wider symbols) or a single character that isn't a digit.
+// Profiling build: add -DVALLI_TRACE=1 for a JSON report of every block, see trace.hpp
 
 // This implementation is more complicated than the naive approach in the documentation.
 // It uses an an approximate calculation to estimate the binomial, then adjusts it from there.
 // Also some shortcuts for trivial values and other minor optimizations.
+// The decoding itself lives in valli.hpp, this maps the .vli and decodes it a block at a time
+// straight into the mapped output file.
 #include <iostream>     // cout
-#include <fstream>      // ifstream,ofstream
-#include <bitset>       // bitset
-#include <immintrin.h>  // intrinsics
-#include <chrono>       // timer
-#include <math.h>       // log2
-#include <gmp.h>        // bigint mpz_t
-#include <algorithm>    // sort
+#include <vector>
 
-#include "utility-functions.hpp"
+#include "valli.hpp"
+#include "gmp-arena.hpp"
+#include "mapped-file.hpp"
 
 
 using namespace std;
 
-int main(int argc, char* argv[]) {
+// symbol argument of --count and --locate: a number, or a single character
+static bool parse_symbol(const char* arg, uint32_t& symbol) {
+    char* end;
+    unsigned long long value = strtoull(arg, &end, 0);
+    if(*arg && !*end && value <= UINT32_MAX) {
+        symbol = (uint32_t)value;
+        return true;
+    }
+    if(arg[0] && !arg[1]) {
+        symbol = (unsigned char)arg[0];
+        return true;
+    }
+    return false;
+}
 
+static int decompress(int argc, char* argv[]) {
+    // options first, a range to decode instead of the whole file, or a symbol to count or locate
+    bool range_only = false;
+    string query;
+    uint32_t query_symbol = 0;
+    uint64_t range_offset = 0;
+    uint64_t range_length = 0;
+    if(argc >= 4 && string(argv[1]) == "--range") {
+        range_only = true;
+        char* end;
+        range_offset = strtoull(argv[2], &end, 10);
+        bool valid = *argv[2] && !*end;
+        range_length = strtoull(argv[3], &end, 10);
+        if(!valid || !*argv[3] || *end) {
+            cout << "Invalid range: " << argv[2] << " " << argv[3] << endl;
+            return 1;
+        }
+        // drop the option, keeping the program name in argv[0]
+        argv[3] = argv[0];
+        argv += 3;
+        argc -= 3;
+    } else if(argc >= 3 && (string(argv[1]) == "--count" || string(argv[1]) == "--locate")) {
+        query = argv[1];
+        if(!parse_symbol(argv[2], query_symbol)) {
+            cout << "Invalid symbol: " << argv[2] << endl;
+            return 1;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     // verify args
-    if (argc != 2) {
-        cout << "Specify a compressed file ending in .vli, example: " << argv[0] << " <file>" << endl;
+    if (argc != 2 && argc != 3) {
+        cout << "Specify a compressed file ending in .vli and optionally a thread count, example: " << argv[0] << " [--range <offset> <length> | --count <symbol> | --locate <symbol>] <file> [threads]" << endl;
         return 1;
     }
+    // threads used to unrank the symbols of a block, defaults to one per core
+    size_t thread_count = ThreadPool::defaultThreads();
+    if(argc == 3) {
+        thread_count = strtoull(argv[2], NULL, 10);
+        if(thread_count == 0) {
+            cout << "Invalid thread count: " << argv[2] << endl;
+            return 1;
+        }
+    }
+    ValliDecoder decoder(thread_count);
+    // verbose output of the math for each symbol, queries only print their results
+    decoder.log = query.empty() ? &cout : nullptr;
 
     // variable to set file output
     bool write_file = true;
@@ -32,296 +93,189 @@ int main(int argc, char* argv[]) {
     // validate and set filenames
     string compressed_path_file = argv[1];
     string file_ending = ".vli";
-    // Ensure file ending is .vli, no other validation performed.
-    // Will error out (vector out of bounds) if the encoded data value is too large for the frequency counts.
-    // Since this *should* only be caused by user error/manipulation, leaving unhandled for now.
-    // *could also be cause by bugs, please report any issues
-    // Else, every value smaller than the max permutations will decompress to some permutation of symbols.
+    // Ensure file ending is .vli, the container header is validated after opening.
+    // Blocks whose encoded value is too large for their frequency counts are rejected,
+    // every value smaller than the max permutations will decompress to some permutation of symbols.
     if (!(compressed_path_file.length() >= file_ending.length() && compressed_path_file.compare(compressed_path_file.length() - file_ending.length(), file_ending.length(), file_ending) == 0)) {
         cout << "Invalid filename, must end with '.vli'" << endl;
         return 1;
     } 
 
-    // assume frequencies file name & location based on source file name
     string basename = compressed_path_file.substr(0, compressed_path_file.length() - file_ending.length());
-    string filename_freq_table = basename + ".freq";
     // create a new output file so that they can be compared to the source
-    string filename_out = basename + ".decom";
+    string filename_out = basename + (range_only ? ".range" : ".decom");
 
     cout << "Compressed file: " << compressed_path_file << endl;
-    cout << "Frequencies file: " << filename_freq_table << endl;
-    cout << "Output file: " << filename_out << endl;
+    if(query.empty()) {
+        cout << "Output file: " << filename_out << endl;
+    }
 
-    // read file
-    std::ifstream input_file(compressed_path_file, std::ios::binary);
-    if (!input_file) {
+    // map file, payloads are imported straight from the mapping
+    MappedInputFile input_file;
+    // a range only reads a few places of the file
+    if (!input_file.open(compressed_path_file, !range_only)) {
         // Handle file open error
         std::cerr << "Error opening file, most likely file does not exist." << std::endl;
         return 1;
     }
-    // deserialize frequency table at start of file
-    FreqChar freqs;
-    size_t freq_byte_count = freqs.deserialize(input_file);
-    if (!input_file) {
-        std::cerr << "Error reading frequency table." << std::endl;
+    const unsigned char* input = input_file.data;
+    size_t input_offset;
+    // the header is checked against the file's size before the output is sized from it
+    valli_status header_status = decoder.beginContainer(input, input_file.size, &input_offset);
+    if(header_status == VALLI_ERROR_TRUNCATED) {
+        std::cerr << "Truncated .vli, the file is too short for its header." << std::endl;
         return 1;
     }
-    cout << "Frequency table size (bytes):" << freq_byte_count << endl;
-    
-    cout << "Frequencies:" << endl;
-    cout << "int : char : count" << endl;
-    uint64_t total_symbols = 0;
-    uint64_t unique_symbols = 0;
-    for (int i = 0; i < 256; i++) {
-        if(freqs.getCount(i)) {
-            cout << (uint)freqs.getChar(i) << " : " << freqs.getChar(i) << " : " << freqs.getCount(i) << endl;
-            total_symbols += freqs.getCount(i);
-            unique_symbols++;
-        }
-    }
-    
-    // load encoding into input_buffer
-    std::vector<char> input_buffer((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
-    // Check successful file read
-    if (!input_file && !input_file.eof()) {
-        std::cerr << "Error reading encoding." << std::endl;
+    if(header_status != VALLI_OK) {
+        std::cerr << "Not a .vli container or unsupported version." << std::endl;
         return 1;
     }
-    input_file.close();
-    cout << "Encoding size (bytes): " << input_buffer.size() << endl;
-
-    mpz_t     compressed_data, symbol_combo, extracted_combo, root_result, binomial, numerator, denominator, factorial, uncombiner, est_binomial;
-    mpz_inits(compressed_data, symbol_combo, extracted_combo, root_result, binomial, numerator, denominator, factorial, uncombiner, est_binomial, NULL);
-
-    // export and import must match
-    // mpz_export(output_array, NULL,                1, 1, -1, 0, data_accumulator);
-    mpz_import(compressed_data, input_buffer.size(), 1, 1, -1, 0, input_buffer.data());
+    ContainerHeader& header = decoder.header;
+    cout << "Symbol width: " << (int)header.symbol_bytes << " bytes" << endl;
+    cout << "Block size: " << header.block_size << " bytes" << endl;
+    cout << "Block count: " << header.block_count << endl;
+    cout << "Decompressed size: " << header.total_size << " bytes" << endl;
+    cout << "Block index: " << ((header.flags & VLI_FLAG_INDEX) ? "yes" : "no") << endl;
+    cout << "Coding: " << ((header.flags & VLI_FLAG_WAVELET) ? "alphabet partition tree" : "symbol by symbol") << endl;
+    cout << "Context streams: " << ((header.flags & VLI_FLAG_CONTEXT) ? "per block" : "no") << endl;
+    cout << "Stages: " << ((header.flags & VLI_FLAG_STAGES) ? "per block" : "none") << endl;
 
-    // verbose info
-    gmp_printf("Imported Integer: %Zd\n", compressed_data);
-    if(unique_symbols < 1) {
-        // todo: handle this case, not implemented
-        cout << "Not enough unique symbols, 2 required in current implementation, aborting." << endl;
-        return 1;
-    }
-    
-    // This implementation fills the output message buffer with the
-    // last symbol and uses it as an 'empty' location indicator.
-    // After all other symbols are placed correctly the
-    // last symbol is already in the correct locations.
-    char last_symbol = (char)freqs.getChar(255);
-    // allocate buffer for decoded output,  fill with most common character
-    std::vector<char> output_buffer(total_symbols, last_symbol);
-    uint64_t remaining_locations = total_symbols;
-
-    mpz_set_ui(uncombiner, 1);
-    size_t symbol_start=256; //starting out of bounds
-    // start at 254 becuase last symbol isnt encoded
-
-    // symbol index
-    size_t symbol_idx = 0;
-    // advance index to start of populated symbols
-    while(freqs.getCount(symbol_idx) == 0) {
-        symbol_idx++;
-    } 
-
-    // Loop through each symbol, except the last 
-    while(symbol_idx < 255) {
-        // verbose output
-        cout << "------------------------------------" << endl;
-        char current_symbol = (char)freqs.getChar(symbol_idx);
-        cout << "Current symbol: " << current_symbol << " (" << (uint)current_symbol << ")" << endl;
-        cout << "Locations remaining: " << remaining_locations << endl;
-        // To extract symbol_combo from compressed_data
-        // we mod the compressed_data by the number of combinations for that symbol
-        // then subtract out that remainder and repeat for next symbol
-
-        // 2nd to last value, calculation & extraction not needed
-        if(symbol_idx != 254) {
-            // calculate permutations of symbol="uncombiner" to extract symbol combination
-            choose_reuse(remaining_locations, freqs.getCount(symbol_idx), uncombiner, numerator, denominator);
-            // compressed data = quotient
-            // extracted combo = remainder
-            mpz_tdiv_qr(compressed_data, extracted_combo, compressed_data, uncombiner);
-        } else {
-            // Last encoded value
-            // no more extraction needed, what remains is the 254th symbol's sum of binomials
-            // because uncombiner == 1 so extracted_combo = compressed_data
-            mpz_set(extracted_combo, compressed_data);
+    if(!query.empty()) {
+        cout << "Symbol: " << query_symbol << endl;
+        uint64_t occurrences = 0;
+        uint64_t blocks_containing = 0;
+        std::vector<uint64_t> positions;
+        valli_status status = query == "--count" ? decoder.count(input, input_file.size, query_symbol, &occurrences, &blocks_containing)
+                                                 : decoder.locate(input, input_file.size, query_symbol, positions);
+        if(status == VALLI_ERROR_INVALID_ARGUMENT) {
+            std::cerr << "Symbol is wider than the file's symbols." << std::endl;
+            return 1;
         }
-        
-        // verbose output
-        gmp_printf("Uncombiner: %Zd \n", uncombiner);    
-        gmp_printf("Extracted Binomial Sum: %Zd \n", extracted_combo);
-
-        // setup loop to deconstruct the extracted binomial sum
-        // largest index location extracted first
-        size_t symbol_count = freqs.getCount(symbol_idx);
-        size_t insert_offset = total_symbols - remaining_locations;
-        // zero based index for locations
-        size_t loc_idx;
-        size_t last_loc_idx = total_symbols - 1; 
-        // size_t removed_symbols = total_symbols - remaining_locations;
-        // calculate factorial 
-        mpz_fac_ui(factorial, symbol_count);
-
-        // Symbol extraction innner loop
-        // continue while symbol_count > extracted_combo
-        // this avoids estimates that are below zero
-        while(mpz_cmp_ui(extracted_combo, symbol_count) > 0) {
-            // use sum of binomials property, combined with Newton's method
-            // combo ~= (n-k//2)^k / k!
-            // (combo*k!)^(1/k) + k//2 ~= n
-            
-            // multiply in k!
-            mpz_mul(symbol_combo, extracted_combo, factorial);
-            
-            // find the root
-            mpz_root(root_result, symbol_combo, symbol_count);
-            // add symbol_count//2 to go from near the middle to near the top=n
-            size_t loc_idx = mpz_get_ui(root_result) + symbol_count/2;
-            
-            // calculate estimated binomial value
-            choose_reuse(loc_idx, symbol_count, est_binomial, numerator, denominator);
-            // verbose output
-            cout << "Estimated: " << loc_idx << " choose " << symbol_count << endl;
-
-            // Validate estimation (1 & 2) //
-            // (1) ensure estimate is less than target value, some even values of k can over estimate
-            if(mpz_cmp(est_binomial, extracted_combo) > 0) {
-                // if overestimated, shift N down by 1
-                // N-1 choose K: multiply by N-K; divide by N
-                mpz_mul_ui(est_binomial, est_binomial, loc_idx-symbol_count);
-                mpz_divexact_ui(est_binomial, est_binomial, loc_idx);
-                loc_idx -= 1;
-                cout << "Adjusted down" << endl;
-            }
-            // (2) ensure estimate is not too low by looking at the delta
-            // todo: opt: can skip if corrected down
-            // subtract estimate from binomial
-            mpz_sub(extracted_combo, extracted_combo, est_binomial);
-            // calculate diff between N choose K and N+1 choose K => N choose K-1 => est_binomial *K then /(N-K+1)
-            mpz_mul_ui(est_binomial, est_binomial, symbol_count);
-            // todo: should be removable, checked for safety
-            // avoid div by zero
-            if(loc_idx-symbol_count+1 != 0) {
-                // est_binomial / (N-K+1)
-                mpz_divexact_ui(est_binomial, est_binomial, loc_idx-symbol_count+1); 
-            }
-            
-            // tracking for information purposes only, not needed for calculation
-            size_t adjust_up_count = 0;
-            cout << "---Adjustment loop---" << endl;
-            
-            // Estimate adjustment loop
-            // while(delta to next binomial < remaining sum of binomials)
-            while(mpz_cmp(est_binomial, extracted_combo) <= 0 && mpz_cmp_ui(extracted_combo, symbol_count) > 0) {
-                // estimate too small, adjust estimated N up by 1
-                // subtract diff (N Choose K-1)
-                mpz_sub(extracted_combo, extracted_combo, est_binomial);
-                loc_idx += 1;
-                // calculate next diff and confirm
-                // to continue calculation up, estimate N+1 choose K = current estimate *N+1; /N-K to current estimate
-                // if estimate is zero, cannot shift up
-                if(loc_idx<=symbol_count) {
-                    //then previous estimate is 0, set est_binomial = 1
-                    mpz_set_ui(est_binomial, 1);
-                    loc_idx = symbol_count;
-                } else {
-                    mpz_mul_ui(est_binomial, est_binomial, loc_idx);
-                }
-                //avoid division by zero
-                if(loc_idx-symbol_count != 0) { 
-                    mpz_divexact_ui(est_binomial, est_binomial, loc_idx-(symbol_count-1));
-                    // mpz_divexact_ui(est_binomial, est_binomial, loc_idx-symbol_count+1)); // cleaner? VERIFY
-                }
-                adjust_up_count += 1;             
-            }
-            // verbose output
-            cout << "Adjusted up: " << adjust_up_count << "x" << endl;
-
-            // calculate offset based on previously placed symbols
-            // optimization: start with the total count of placed symbols, subtract already placed symbols as we move backwards
-            // for each non-last symbol found, reduce the offset
-            // cout << "loop: " << last_loc_idx << " to " << loc_idx+insert_offset << endl;
-            for(size_t i=last_loc_idx; i>=loc_idx+insert_offset && insert_offset!=0; i--) {
-                if(output_buffer[i] != last_symbol) {
-                    insert_offset--;
-                }
+        if(status != VALLI_OK) {
+            std::cerr << "Error reading file: " << (status == VALLI_ERROR_TRUNCATED ? "truncated" : "corrupt") << "." << std::endl;
+            return 1;
+        }
+        if(query == "--count") {
+            cout << "Occurrences: " << occurrences << endl;
+            cout << "Blocks containing it: " << blocks_containing << endl;
+        } else {
+            cout << "Occurrences: " << positions.size() << endl;
+            for(uint64_t position : positions) {
+                cout << position << "\n";
             }
-            // verbose output
-            cout << "Location offset: " << insert_offset << endl;
-            last_loc_idx = loc_idx+insert_offset-1; // -1 because current placement location already checked
-            //update character in output buffer
-            cout << "Symbol placed at: " << loc_idx+insert_offset << endl; 
-            output_buffer.at(loc_idx+insert_offset) = current_symbol;
-
-            // Setup next loop
-            // calculate next lower factorial=(N-1)!=(N!)/N
-            mpz_divexact_ui(factorial, factorial, symbol_count);
-            symbol_count -= 1;            
+            cout.flush();
         }
-
-        // if symbol_count <= extracted combo, decoding is trivial
-        if(symbol_count != 0 && mpz_cmp_ui(extracted_combo, symbol_count) <= 0) {
-            cout << "symbol_count <= remaining sum of binomials" << symbol_count << endl;
-            // gmp_printf("extracted_combo: %Zd\n", extracted_combo);
-            // cout << "symbol_count: " << symbol_count << endl;
-            size_t null_idx = 0;
-            do {
-                // seek to next non-null index
-                while(output_buffer[null_idx] != last_symbol) {
-                        null_idx += 1;
-                }
-                if(mpz_cmp_ui(extracted_combo, symbol_count) < 0) {
-                    // if symbol count gt extracted combo place all remaining symbols in in the first location they appear
-                    output_buffer.at(null_idx) = current_symbol;
-                    cout << "Symbol placed at: " << null_idx << endl; 
-                    symbol_count -= 1;
-                } else if(mpz_cmp_ui(extracted_combo, symbol_count) == 0) {
-                    // if equal skip one location
-                    null_idx += 1;
-                    while(output_buffer[null_idx] != last_symbol) {
-                        null_idx += 1;
-                    }
-                    output_buffer.at(null_idx) = current_symbol;
-                    cout << "Symbol placed at: " << null_idx << endl;
-                    symbol_count -= 1;
-                } else {
-                    // if lt, continue placing
-                    output_buffer.at(null_idx) = current_symbol;
-                    cout << "Symbol placed at: " << null_idx << endl;
-                    symbol_count -= 1;
-                }
-            } while(symbol_count > 0);
+        print_gmp_total_stats();
+        string trace_path = compressed_path_file + ".trace.json";
+        if(trace_write_report(trace_path)) {
+            cout << "Trace report: " << trace_path << endl;
         }
-        //used for next loop and location placement later
-        remaining_locations -= freqs.getCount(symbol_idx);
-        symbol_idx++;
+        return 0;
     }
 
-    // decompression done, final output:
-    cout << "----------------------------------" << endl;
-    // print decompressed data to console
-    for (const auto& value : output_buffer) {
-        cout << value;
+    if(range_only) {
+        cout << "Range: " << range_length << " bytes from " << range_offset << endl;
+        if(range_offset > header.total_size || range_length > header.total_size - range_offset) {
+            std::cerr << "Range is past the end of the decompressed data." << std::endl;
+            return 1;
+        }
+        cout << "Writing decompressed range to: " << filename_out << endl;
+        MappedOutputFile output_file;
+        if(!output_file.open(filename_out, range_length)) {
+            std::cerr << "Failed creating output file." << std::endl;
+            return 1;
+        }
+        size_t written;
+        valli_status status = decoder.decodeRange(input, input_file.size, range_offset, range_length, (char*)output_file.data, output_file.capacity, &written);
+        if(status != VALLI_OK) {
+            output_file.discard();
+            std::cerr << "Error reading range: " << (status == VALLI_ERROR_TRUNCATED ? "truncated" : "corrupt") << "." << std::endl;
+            return 1;
+        }
+        print_gmp_total_stats();
+        string trace_path = filename_out + ".trace.json";
+        if(trace_write_report(trace_path)) {
+            cout << "Trace report: " << trace_path << endl;
+        }
+        if(!output_file.close(written)) {
+            std::cerr << "Error writing " << filename_out << std::endl;
+            return 1;
+        }
+        return 0;
     }
-    cout << endl;
 
-    cout << "Writing decompressed data to: " << filename_out << endl;
+    // The output file is created at its final size (from the header) and mapped,
+    // blocks are decoded straight into it.
+    // Without file output, blocks go to a scratch buffer that is reused.
+    MappedOutputFile output_file;
+    std::vector<unsigned char> scratch;
     // check setting for file output
     if (write_file) {
-        //output to file
-        ofstream output_file(filename_out);
-        if (!output_file.is_open()) {
-            std::cerr << "Failed creating output file." << std::endl;
+        cout << "Writing decompressed data to: " << filename_out << endl;
+        if (!output_file.open(filename_out, header.total_size)) {
+            std::cerr << "Failed creating output file of " << header.total_size << " bytes." << std::endl;
             return 1;
         }
-        for (const auto& value : output_buffer) {
-            output_file << value;
+    } else {
+        scratch.resize(std::min(header.block_size, header.total_size));
+    }
+
+    uint64_t decompressed_size = 0;
+    for(uint64_t block_idx = 0; block_idx < header.block_count; block_idx++) {
+        cout << "=========== Block " << block_idx << " ===========" << endl;
+        char* output = (char*)(write_file ? output_file.data + decompressed_size : scratch.data());
+        size_t capacity = write_file ? output_file.capacity - decompressed_size : scratch.size();
+        size_t consumed, written;
+        valli_status status = decoder.decodeBlock(input + input_offset, input_file.size - input_offset, &consumed,
+                                                  output, capacity, &written);
+        if(status != VALLI_OK) {
+            output_file.discard();
+            std::cerr << "Error reading block " << block_idx << ": " << (status == VALLI_ERROR_TRUNCATED ? "truncated" : "corrupt") << "." << std::endl;
+            return 1;
         }
-        output_file.close();
+        input_offset += consumed;
+
+        // decompression done, final output:
+        // print decompressed data to console, in detail builds (-DVALLI_TRACE=2)
+        VALLI_TRACE_DETAIL(
+            cout << "----------------------------------" << endl;
+            cout.write(output, written);
+            cout << endl;
+        )
+
+        decompressed_size += written;
+        print_gmp_block_stats();
+        // the next block's statistics start from zero, the arenas rewind by themselves
+        gmp_arena_rewind();
+    }
+    print_gmp_total_stats();
+    // builds with -DVALLI_TRACE=1 also write the phase timings and counters, see trace.hpp
+    string trace_path = filename_out + ".trace.json";
+    if(trace_write_report(trace_path)) {
+        cout << "Trace report: " << trace_path << endl;
+    }
+
+    if(decompressed_size != header.total_size) {
+        output_file.discard();
+        std::cerr << "Decompressed size does not match the header." << std::endl;
+        return 1;
+    }
+    if (write_file && !output_file.close(decompressed_size)) {
+        std::cerr << "Error writing " << filename_out << std::endl;
+        return 1;
     }
 
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    // every bignum goes through the per block arenas, must come before any mpz_init
+    gmp_arena_install();
+    try {
+        return decompress(argc, argv);
+    } catch(const std::bad_alloc&) {
+        // a block larger than this machine can hold
+        std::cerr << "Out of memory." << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,98 @@
+// Mixed radix combination of the per symbol encodings
+// Each encoded symbol is a digit whose radix is the number of ways to place it:
+//     (remaining locations) choose (symbol count)
+// The encoded value is digit[0] + radix[0]*(digit[1] + radix[1]*(digit[2] + ...))
+// Folding the digits in one at a time multiplies the full size accumulator for every symbol.
+// A balanced tree keeps both operands of every multiply/divide similar in size, so GMP's
+// subquadratic algorithms do the heavy lifting.
+#pragma once
+
+#include <gmp.h>  //mpz_t
+
+#include "utility-functions.hpp"
+#include "trace.hpp"
+
+struct ProductTree {
+    // node 1 covers all digits, node i has children 2i and 2i+1, each node holds the product of its radices
+    MpzArray nodes;
+    size_t digit_count = 0;
+
+    // build the tree bottom up from the radices of each digit
+    void build(MpzArray& radices) {
+        digit_count = radices.size();
+        nodes.resize(digit_count ? 4*digit_count : 1);
+        if(digit_count) {
+            buildNode(1, 0, digit_count, radices);
+        } else {
+            // no digits, empty product
+            mpz_set_ui(nodes[0], 1);
+        }
+    }
+
+    // product of all radices, the total number of permutations of the symbols
+    mpz_t& total() {
+        return digit_count ? nodes[1] : nodes[0];
+    }
+
+    // result = mixed radix value of the digits
+    void combine(MpzArray& digits, mpz_t result) {
+        if(digit_count) {
+            combineNode(1, 0, digit_count, digits, result);
+        } else {
+            mpz_set_ui(result, 0);
+        }
+    }
+
+    // inverse of combine: split value into one digit per radix
+    // the last digit takes whatever remains, it is not reduced by its radix
+    void split(mpz_t value, MpzArray& digits) {
+        if(digit_count) {
+            splitNode(1, 0, digit_count, value, digits);
+        }
+    }
+
+  private:
+    void buildNode(size_t node, size_t lo, size_t hi, MpzArray& radices) {
+        if(hi - lo == 1) {
+            mpz_set(nodes[node], radices[lo]);
+            return;
+        }
+        size_t mid = lo + (hi - lo)/2;
+        buildNode(2*node, lo, mid, radices);
+        buildNode(2*node+1, mid, hi, radices);
+        mpz_mul(nodes[node], nodes[2*node], nodes[2*node+1]);
+        VALLI_TRACE_COUNT(TRACE_TREE_MULTIPLIES);
+    }
+
+    void combineNode(size_t node, size_t lo, size_t hi, MpzArray& digits, mpz_t result) {
+        if(hi - lo == 1) {
+            mpz_set(result, digits[lo]);
+            return;
+        }
+        size_t mid = lo + (hi - lo)/2;
+        mpz_t upper;
+        mpz_init(upper);
+        combineNode(2*node, lo, mid, digits, result);
+        combineNode(2*node+1, mid, hi, digits, upper);
+        // lower digits + (product of lower radices) * upper digits
+        mpz_addmul(result, nodes[2*node], upper);
+        VALLI_TRACE_COUNT(TRACE_TREE_MULTIPLIES);
+        mpz_clear(upper);
+    }
+
+    void splitNode(size_t node, size_t lo, size_t hi, mpz_t value, MpzArray& digits) {
+        if(hi - lo == 1) {
+            mpz_set(digits[lo], value);
+            return;
+        }
+        size_t mid = lo + (hi - lo)/2;
+        mpz_t quotient, remainder;
+        mpz_inits(quotient, remainder, NULL);
+        // remainder = lower digits, quotient = upper digits
+        mpz_tdiv_qr(quotient, remainder, value, nodes[2*node]);
+        VALLI_TRACE_COUNT(TRACE_TREE_DIVISIONS);
+        splitNode(2*node, lo, mid, remainder, digits);
+        splitNode(2*node+1, mid, hi, quotient, digits);
+        mpz_clears(quotient, remainder, NULL);
+    }
+};
@@ -0,0 +1,114 @@
+// Removed location bitmap for the encoder and decoder
+// One bit per message location, set once the location's symbol has been encoded (or placed by
+// the decoder), plus the number of removed locations in every superblock of 4096 locations (64 words).
+// Removal is tracked here instead of by overwriting the message with a 'null' symbol, so every
+// byte value can be in a block and the loops never compare symbols.
+// The encoder visits a symbol's locations in ascending order, so the number of removed
+// locations before each one is a running popcount that only moves forward: whole superblocks
+// are skipped with their count, the words in between are popcounted, and the partial word is masked.
+// The decoder does the inverse, the location of the j-th remaining location, with the same sweep.
+// A symbol costs at most one pass over the bitmap (n/64 words) and usually far less, so a block
+// is linear in its size, instead of a Fenwick tree's O(log n) scattered reads per location.
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// position of the rank-th (0 based) set bit of word, it must have more than rank set bits
+inline int select_bit(uint64_t word, int rank) {
+    // skip whole bytes, then clear the lowest set bits
+    int shift = 0;
+    for(int count = __builtin_popcountll(word & 0xFF); count <= rank && shift < 56; count = __builtin_popcountll((word >> shift) & 0xFF)) {
+        rank -= count;
+        shift += 8;
+    }
+    uint64_t bits = word >> shift;
+    for(; rank > 0; rank--) {
+        bits &= bits - 1;
+    }
+    return shift + __builtin_ctzll(bits);
+}
+
+struct RemovedBitmap {
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> superblock_counts;
+
+    static const size_t superblock_words = 64;
+
+    // clear and size for n locations, none removed
+    void reset(size_t n) {
+        words.assign((n + 63) / 64 + 1, 0);
+        superblock_counts.assign(words.size() / superblock_words + 1, 0);
+    }
+
+    void remove(size_t loc) {
+        words[loc >> 6] |= 1ull << (loc & 63);
+        superblock_counts[(loc >> 6) / superblock_words]++;
+    }
+
+    // Counts removed locations before ascending locations, see removedBefore.
+    // Only valid while the bitmap doesn't change, remove a symbol's locations after its sweep.
+    struct Sweep {
+        RemovedBitmap& bitmap;
+        size_t word = 0;
+        size_t superblock = 0;
+        // removed locations before word, and in the current superblock before word
+        uint64_t removed = 0;
+        uint64_t removed_in_superblock = 0;
+
+        explicit Sweep(RemovedBitmap& bitmap) : bitmap(bitmap) {}
+
+        // removed locations in [0, loc), loc must not be smaller than the previous call's
+        uint64_t removedBefore(size_t loc) {
+            size_t target_word = loc >> 6;
+            size_t target_superblock = target_word / superblock_words;
+            if(superblock < target_superblock) {
+                // rest of the current superblock, then whole superblocks up to the target
+                removed += bitmap.superblock_counts[superblock] - removed_in_superblock;
+                for(superblock++; superblock < target_superblock; superblock++) {
+                    removed += bitmap.superblock_counts[superblock];
+                }
+                word = superblock * superblock_words;
+                removed_in_superblock = 0;
+            }
+            for(; word < target_word; word++) {
+                uint64_t count = __builtin_popcountll(bitmap.words[word]);
+                removed += count;
+                removed_in_superblock += count;
+            }
+            uint64_t below = bitmap.words[target_word] & ((1ull << (loc & 63)) - 1);
+            return removed + __builtin_popcountll(below);
+        }
+
+        // location of the rank-th (0 based) location not removed, rank must not be smaller than
+        // the previous call's, and there must be more than rank locations left
+        // locations found can be removed right away, the next rank then counts without them
+        size_t nthRemaining(uint64_t rank) {
+            // whole superblocks whose remaining locations are all before the target
+            size_t last_superblock = bitmap.superblock_counts.size() - 1;
+            while(superblock < last_superblock) {
+                uint64_t removed_at_end = removed + bitmap.superblock_counts[superblock] - removed_in_superblock;
+                uint64_t remaining_at_end = (superblock + 1) * superblock_words * 64 - removed_at_end;
+                if(remaining_at_end > rank) {
+                    break;
+                }
+                removed = removed_at_end;
+                superblock++;
+                word = superblock * superblock_words;
+                removed_in_superblock = 0;
+            }
+            // whole words, the target is in this superblock
+            size_t last_word = bitmap.words.size() - 1;
+            while(word < last_word) {
+                uint64_t count = __builtin_popcountll(bitmap.words[word]);
+                if(word * 64 + 64 - removed - count > rank) {
+                    break;
+                }
+                removed += count;
+                removed_in_superblock += count;
+                word++;
+            }
+            return word * 64 + select_bit(~bitmap.words[word], rank - (word * 64 - removed));
+        }
+    };
+};
@@ -0,0 +1,190 @@
+// Work stealing thread pool
+// Each worker has its own queue, it takes the newest task from its own queue first and
+// steals the oldest task from another worker's queue when its own is empty.
+// Tasks may submit more tasks, they go to the submitting worker's queue.
+// The queues only share atomic counters, a global lock is only taken to put an idle worker to
+// sleep and to wake it up.  An exception thrown by a task is rethrown by the next wait().
+// With 0 threads, tasks run immediately on the submitting thread.
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>  // exception_ptr
+
+struct ThreadPool {
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    // tasks submitted and not finished, tasks in a queue (counted under the queue's lock, so
+    // queued > 0 means some queue has one), workers asleep waiting for one
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleeping{0};
+    std::atomic<size_t> next_queue{0};
+    std::atomic<bool> stopping{false};
+    // only for sleeping and waking up, busy workers never take it
+    std::mutex idle_lock;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    // first exception thrown by a task since the last wait
+    std::mutex error_lock;
+    std::exception_ptr error;
+
+    // number of threads a pool should use by default
+    static size_t defaultThreads() {
+        size_t hardware_threads = std::thread::hardware_concurrency();
+        return hardware_threads ? hardware_threads : 1;
+    }
+
+    explicit ThreadPool(size_t thread_count) {
+        for(size_t i = 0; i < thread_count; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for(size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+    ~ThreadPool() {
+        stopping = true;
+        wakeWorkers(true);
+        for(auto& thread : threads) {
+            thread.join();
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() {
+        return threads.size();
+    }
+
+    void submit(std::function<void()> task) {
+        if(threads.empty()) {
+            task();
+            return;
+        }
+        // workers push to their own queue, other threads spread tasks round robin
+        size_t queue_idx = (current_pool() == this) ? current_worker() : next_queue++ % queues.size();
+        pending++;
+        {
+            std::lock_guard<std::mutex> guard(queues[queue_idx]->lock);
+            queues[queue_idx]->tasks.push_back(std::move(task));
+            queued++;
+        }
+        // a worker going to sleep counts itself before checking queued, so either it sees
+        // this task or it is seen here
+        if(sleeping > 0) {
+            wakeWorkers(false);
+        }
+    }
+
+    // block until every submitted task, including tasks they submitted, has finished
+    // rethrows the first exception a task threw, the other tasks still ran to the end
+    // must not be called from inside a task
+    void wait() {
+        {
+            std::unique_lock<std::mutex> guard(idle_lock);
+            all_done.wait(guard, [this] { return pending == 0; });
+        }
+        std::exception_ptr thrown;
+        {
+            std::lock_guard<std::mutex> guard(error_lock);
+            std::swap(thrown, error);
+        }
+        if(thrown) {
+            std::rethrow_exception(thrown);
+        }
+    }
+
+  private:
+    // pool and index of the worker running on this thread, pool is null for other threads
+    static ThreadPool*& current_pool() {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+    static size_t& current_worker() {
+        static thread_local size_t worker_idx = 0;
+        return worker_idx;
+    }
+
+    // the lock makes sure a worker isn't between checking for work and waiting
+    void wakeWorkers(bool all) {
+        {
+            std::lock_guard<std::mutex> guard(idle_lock);
+        }
+        if(all) {
+            work_available.notify_all();
+        } else {
+            work_available.notify_one();
+        }
+    }
+
+    // take a task, own queue newest first, then steal oldest from the others
+    bool takeTask(size_t worker_idx, std::function<void()>& task) {
+        for(size_t i = 0; i < queues.size(); i++) {
+            WorkerQueue& queue = *queues[(worker_idx + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if(!queue.tasks.empty()) {
+                if(i == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runTask(std::function<void()>& task) {
+        try {
+            task();
+        } catch(...) {
+            // handed to wait(), unwinding out of the worker would terminate the process
+            std::lock_guard<std::mutex> guard(error_lock);
+            if(!error) {
+                error = std::current_exception();
+            }
+        }
+        // the captures go before the task counts as finished
+        task = nullptr;
+        if(--pending == 0) {
+            std::lock_guard<std::mutex> guard(idle_lock);
+            all_done.notify_all();
+        }
+    }
+
+    void workerLoop(size_t worker_idx) {
+        current_pool() = this;
+        current_worker() = worker_idx;
+        std::function<void()> task;
+        while(true) {
+            if(takeTask(worker_idx, task)) {
+                runTask(task);
+                continue;
+            }
+            if(stopping) {
+                return;
+            }
+            // nothing to take or steal, sleep until a task is queued
+            sleeping++;
+            {
+                std::unique_lock<std::mutex> guard(idle_lock);
+                work_available.wait(guard, [this] { return queued > 0 || stopping; });
+            }
+            sleeping--;
+        }
+    }
+};
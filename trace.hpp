@@ -0,0 +1,284 @@
+// Tracing and metrics for profiling
+// Compiled out by default: every VALLI_TRACE_* macro expands to nothing unless the build defines
+// VALLI_TRACE, so the encoding and decoding loops carry no timers, counters or branches.
+//   -DVALLI_TRACE=1  every block records the wall time of each phase (histogram, sort, ranking,
+//                    combine, export, ...), counts of the bignum operations (binomials computed
+//                    or served from the cache, ranker steps and restarts, product tree multiplies...),
+//                    the size in limbs of its encoded value and the time spent on each symbol.
+//                    trace_write_report() writes everything as JSON.
+//   -DVALLI_TRACE=2  also prints every symbol placement, sum of binomials and full size bignum
+//                    to the encoder's/decoder's log, this is far slower than the math itself.
+// The report covers the whole process, blocks are recorded in the order they finish.
+#pragma once
+
+#ifndef VALLI_TRACE
+#define VALLI_TRACE 0
+#endif
+
+#include <string>
+
+// phases of a block, timed on the thread that encodes/decodes it
+enum TracePhase {
+    // encoder
+    TRACE_HISTOGRAM,    // counting symbol frequencies
+    TRACE_SORT,         // sorting the frequency table
+    TRACE_POSITIONS,    // symbol positions and their locations among the remaining ones
+    TRACE_RANK,         // sums of binomials and radices (in parallel with the GMP kernel)
+    TRACE_COMBINE,      // mixed radix combination of the digits
+    TRACE_EXPORT,       // value and frequency table to bytes
+    // decoder
+    TRACE_TABLE,        // reading the frequency table and payload
+    TRACE_IMPORT,       // payload to bignum
+    TRACE_RADICES,      // radices and their product tree
+    TRACE_SPLIT,        // mixed radix split into digits
+    TRACE_UNRANK,       // locations from each digit
+    TRACE_PLACE,        // writing symbols at their absolute locations
+    // both
+    TRACE_STAGES,       // pipeline stages, forward or inverse (pipeline-stages.hpp)
+    TRACE_PHASE_COUNT
+};
+
+// operation counters, summed over every thread
+enum TraceCounter {
+    TRACE_BINOMIALS,            // binomials computed from scratch
+    TRACE_BINOMIAL_CACHE_HITS,  // binomials copied from the cache
+    TRACE_RANK_STEPS,           // ranker terms stepped from the previous term
+    TRACE_RANK_RESTARTS,        // ranker terms computed directly
+    TRACE_UNRANK_STEPS,         // unranker terms stepped from the previous term
+    TRACE_UNRANK_RESTARTS,      // unranker terms computed directly
+    TRACE_UNRANK_CORRECTIONS,   // single location corrections of the unranker's estimate
+    TRACE_TREE_MULTIPLIES,      // product tree multiplies (build and combine)
+    TRACE_TREE_DIVISIONS,       // product tree divisions (split)
+    TRACE_COUNTER_COUNT
+};
+
+#if VALLI_TRACE
+
+#include <ostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <gmp.h>        // GMP_NUMB_BITS
+
+// time of one symbol of a block, the time of its parallel tasks is summed
+struct TraceSymbol {
+    unsigned symbol = 0;
+    uint64_t count = 0;
+    uint64_t remaining = 0;
+    size_t radix_bits = 0;
+    uint64_t nanoseconds = 0;
+};
+
+struct TraceBlock {
+    bool decode = false;
+    uint64_t length = 0;
+    uint64_t unique_symbols = 0;
+    // 0 for GMP, else the native word size
+    int kernel_bits = 0;
+    size_t value_bits = 0;
+    size_t max_bits = 0;
+    size_t table_bytes = 0;
+    size_t payload_bytes = 0;
+    uint64_t nanoseconds = 0;
+    uint64_t phase_ns[TRACE_PHASE_COUNT] = {};
+    uint64_t counters[TRACE_COUNTER_COUNT] = {};
+    std::vector<TraceSymbol> symbols;
+};
+
+// One per thread that counted something, threads only touch their own counters so there
+// is no contention, the totals are read between blocks.
+struct TraceThreadCounters {
+    std::atomic<uint64_t> counts[TRACE_COUNTER_COUNT] = {};
+};
+
+struct Tracer {
+    std::mutex lock;
+    std::vector<std::unique_ptr<TraceThreadCounters>> threads;
+    std::vector<TraceBlock> blocks;
+    // block being recorded
+    TraceBlock current;
+    uint64_t counters_at_begin[TRACE_COUNTER_COUNT] = {};
+    std::chrono::steady_clock::time_point block_start;
+
+    TraceThreadCounters* newThread() {
+        std::lock_guard<std::mutex> guard(lock);
+        threads.emplace_back(new TraceThreadCounters());
+        return threads.back().get();
+    }
+
+    void counterTotals(uint64_t totals[TRACE_COUNTER_COUNT]) {
+        std::lock_guard<std::mutex> guard(lock);
+        for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+            totals[i] = 0;
+            for(auto& thread : threads) {
+                totals[i] += thread->counts[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void beginBlock(bool decode) {
+        current = TraceBlock();
+        current.decode = decode;
+        counterTotals(counters_at_begin);
+        block_start = std::chrono::steady_clock::now();
+    }
+
+    void endBlock() {
+        current.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - block_start).count();
+        uint64_t totals[TRACE_COUNTER_COUNT];
+        counterTotals(totals);
+        for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+            current.counters[i] = totals[i] - counters_at_begin[i];
+        }
+        blocks.push_back(std::move(current));
+        current = TraceBlock();
+    }
+
+    // one entry per encoded symbol of the current block, in encoding order
+    void addSymbol(unsigned symbol, uint64_t count, uint64_t remaining, size_t radix_bits) {
+        TraceSymbol entry;
+        entry.symbol = symbol;
+        entry.count = count;
+        entry.remaining = remaining;
+        entry.radix_bits = radix_bits;
+        current.symbols.push_back(entry);
+    }
+
+    // called from the pool's threads
+    void addSymbolTime(size_t symbol_idx, uint64_t nanoseconds) {
+        std::lock_guard<std::mutex> guard(lock);
+        if(symbol_idx < current.symbols.size()) {
+            current.symbols[symbol_idx].nanoseconds += nanoseconds;
+        }
+    }
+
+    void writeJson(std::ostream& out) {
+        static const char* phase_names[TRACE_PHASE_COUNT] = {
+            "histogram", "sort", "positions", "rank", "combine", "export",
+            "table", "import", "radices", "split", "unrank", "place", "stages"
+        };
+        static const char* counter_names[TRACE_COUNTER_COUNT] = {
+            "binomials", "binomial_cache_hits", "rank_steps", "rank_restarts",
+            "unrank_steps", "unrank_restarts", "unrank_corrections", "tree_multiplies", "tree_divisions"
+        };
+        // only the phases and counters a block used, all of them for the totals
+        auto write_values = [&](const char* name, const uint64_t* values, const char** names, int count, bool skip_zero) {
+            out << "\"" << name << "\": {";
+            bool first = true;
+            for(int i = 0; i < count; i++) {
+                if(skip_zero && values[i] == 0) {
+                    continue;
+                }
+                out << (first ? "" : ", ") << "\"" << names[i] << "\": " << values[i];
+                first = false;
+            }
+            out << "}";
+        };
+
+        uint64_t total_phase_ns[TRACE_PHASE_COUNT] = {};
+        uint64_t total_counters[TRACE_COUNTER_COUNT] = {};
+        uint64_t total_ns = 0;
+        out << "{\n  \"blocks\": [";
+        for(size_t block_idx = 0; block_idx < blocks.size(); block_idx++) {
+            TraceBlock& block = blocks[block_idx];
+            out << (block_idx ? ",\n" : "\n");
+            out << "    {\"index\": " << block_idx << ", \"kind\": \"" << (block.decode ? "decode" : "encode") << "\""
+                << ", \"length\": " << block.length << ", \"unique_symbols\": " << block.unique_symbols
+                << ", \"kernel\": \"" << (block.kernel_bits ? std::to_string(block.kernel_bits) + " bit" : std::string("GMP")) << "\""
+                << ", \"value_bits\": " << block.value_bits << ", \"value_limbs\": " << (block.value_bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS
+                << ", \"max_bits\": " << block.max_bits << ", \"max_limbs\": " << (block.max_bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS
+                << ", \"table_bytes\": " << block.table_bytes << ", \"payload_bytes\": " << block.payload_bytes
+                << ", \"nanoseconds\": " << block.nanoseconds << ",\n     ";
+            write_values("phase_ns", block.phase_ns, phase_names, TRACE_PHASE_COUNT, true);
+            out << ",\n     ";
+            write_values("counters", block.counters, counter_names, TRACE_COUNTER_COUNT, true);
+            out << ",\n     \"symbols\": [";
+            for(size_t i = 0; i < block.symbols.size(); i++) {
+                TraceSymbol& symbol = block.symbols[i];
+                out << (i ? ", " : "") << "{\"symbol\": " << symbol.symbol << ", \"count\": " << symbol.count
+                    << ", \"remaining\": " << symbol.remaining << ", \"radix_bits\": " << symbol.radix_bits
+                    << ", \"nanoseconds\": " << symbol.nanoseconds << "}";
+            }
+            out << "]}";
+            for(int i = 0; i < TRACE_PHASE_COUNT; i++) {
+                total_phase_ns[i] += block.phase_ns[i];
+            }
+            for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+                total_counters[i] += block.counters[i];
+            }
+            total_ns += block.nanoseconds;
+        }
+        out << "\n  ],\n  \"totals\": {\"blocks\": " << blocks.size() << ", \"nanoseconds\": " << total_ns << ", ";
+        write_values("phase_ns", total_phase_ns, phase_names, TRACE_PHASE_COUNT, false);
+        out << ", ";
+        write_values("counters", total_counters, counter_names, TRACE_COUNTER_COUNT, false);
+        out << "}\n}\n";
+    }
+};
+
+inline Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+// this thread's counters, registered on the first count
+inline TraceThreadCounters& trace_thread_counters() {
+    static thread_local TraceThreadCounters* counters = tracer().newThread();
+    return *counters;
+}
+
+// Measures the time between laps, each lap is added to a phase or a symbol
+struct TraceClock {
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    uint64_t lap() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+};
+
+// write the report of every block traced so far, false if the file can't be written
+inline bool trace_write_report(const std::string& path) {
+    std::ofstream out(path);
+    tracer().writeJson(out);
+    return (bool)out;
+}
+
+#define VALLI_TRACE_BLOCK_BEGIN(decode) tracer().beginBlock(decode)
+#define VALLI_TRACE_BLOCK_END() tracer().endBlock()
+#define VALLI_TRACE_BLOCK_SET(field, value) (tracer().current.field = (value))
+#define VALLI_TRACE_CLOCK(clock) TraceClock clock
+#define VALLI_TRACE_LAP(clock, phase) (tracer().current.phase_ns[phase] += (clock).lap())
+#define VALLI_TRACE_COUNT(counter) trace_thread_counters().counts[counter].fetch_add(1, std::memory_order_relaxed)
+#define VALLI_TRACE_SYMBOL(symbol, count, remaining, radix_bits) tracer().addSymbol(symbol, count, remaining, radix_bits)
+#define VALLI_TRACE_SYMBOL_LAP(clock, symbol_idx) tracer().addSymbolTime(symbol_idx, (clock).lap())
+
+#else
+
+// tracing disabled, there is no report to write
+inline bool trace_write_report(const std::string&) {
+    return false;
+}
+
+#define VALLI_TRACE_BLOCK_BEGIN(decode) ((void)0)
+#define VALLI_TRACE_BLOCK_END() ((void)0)
+#define VALLI_TRACE_BLOCK_SET(field, value) ((void)0)
+#define VALLI_TRACE_CLOCK(clock) ((void)0)
+#define VALLI_TRACE_LAP(clock, phase) ((void)0)
+#define VALLI_TRACE_COUNT(counter) ((void)0)
+#define VALLI_TRACE_SYMBOL(symbol, count, remaining, radix_bits) ((void)0)
+#define VALLI_TRACE_SYMBOL_LAP(clock, symbol_idx) ((void)0)
+
+#endif
+
+// statements that print per placement detail, only compiled with VALLI_TRACE=2
+#if VALLI_TRACE >= 2
+#define VALLI_TRACE_DETAIL(...) __VA_ARGS__
+#else
+#define VALLI_TRACE_DETAIL(...)
+#endif
@@ -1,93 +1,186 @@
 // useful functions for binomials and other calculations
+#pragma once
 
-#include <fstream>
 #include <vector>
+#include <string>
+#include <cstring> // strlen
+#include <algorithm> // sort, lower_bound
+#include <math.h> // lgamma
 #include <gmp.h>  //mpz_t
 
 #include "frequency-table.hpp"
+#include "byte-histogram.hpp"
 
 
-// returns if read is valid: true = valid
-bool FileToCharVector(const std::string& filename, std::vector<char>& buffer) {
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file) {
-        // Handle file open error
-        return false;
-    }
+// decimal string of a bignum, for verbose output to a stream
+inline std::string mpz_string(mpz_t value) {
+    std::string digits(mpz_sizeinbase(value, 10) + 2, '\0');
+    mpz_get_str(&digits[0], 10, value);
+    digits.resize(strlen(digits.c_str()));
+    return digits;
+}
 
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+// Fixed size array of mpz_t, all initialized on construction and cleared on destruction
+// (std::vector can't hold mpz_t directly since it is an array type)
+struct MpzArray {
+    mpz_t* data = nullptr;
+    size_t length = 0;
 
-    buffer.resize(fileSize);
-    if (file.read(buffer.data(), fileSize)) {
-        return true;
-    } else {
-        return false;
+    MpzArray(size_t n = 0) {
+        resize(n);
+    }
+    ~MpzArray() {
+        resize(0);
     }
+    MpzArray(const MpzArray&) = delete;
+    MpzArray& operator=(const MpzArray&) = delete;
+    // existing values are not kept
+    void resize(size_t n) {
+        for(size_t i=0; i<length; i++) {
+            mpz_clear(data[i]);
+        }
+        delete[] data;
+        data = n ? new mpz_t[n] : nullptr;
+        length = n;
+        for(size_t i=0; i<length; i++) {
+            mpz_init(data[i]);
+        }
+    }
+    size_t size() {
+        return length;
+    }
+    mpz_t& operator[](size_t i) {
+        return data[i];
+    }
+};
 
+// unsorted frequency table of buffer, entry i is symbol i
+inline void CalcFrequencyPairs(const uint8_t* symbols, size_t size, FreqChar &freqs) {
+    uint64_t counts[256];
+    byte_histogram(symbols, size, counts);
+    // count in the upper 7 bytes, symbol in the lowest
+    for(int i=0; i<256; i++) {
+        freqs.data[i] = (counts[i] << 8) | i;
+    }
 }
 
-void CalcFrequencyPairs(std::vector<char> &buffer, FreqChar &freqs) {
-    // initialize values
-    for(int i=0; i<256; i++) {
-        freqs.data[i] = i;
+// unsorted frequency table of 16 bit symbols, only the used symbols get an entry
+// a direct count per symbol is small enough (512KB) to be cheaper than anything sparse
+inline void CalcFrequencyPairs(const uint16_t* symbols, size_t size, FrequencyTable<uint16_t> &freqs) {
+    std::vector<uint64_t> counts(FrequencyTable<uint16_t>::alphabet_size, 0);
+    for(size_t i=0; i<size; i++) {
+        counts[symbols[i]]++;
+    }
+    freqs.data.clear();
+    for(uint64_t s=0; s<counts.size(); s++) {
+        if(counts[s]) {
+            freqs.data.push_back((counts[s] << 16) | s);
+        }
     }
-    // loop through buffer
-    for (size_t i=0; i < buffer.size(); i++) {
-        freqs.incrCount(buffer[i]);
-        if(buffer[i] < 0) {
-            std::cout << "index: " << i << " value:" << buffer[i] << std::endl;
+}
+
+// unsorted frequency table of 32 bit tokens, only the used tokens get an entry
+// the alphabet is too large to count directly, runs of a sorted copy are counted instead
+inline void CalcFrequencyPairs(const uint32_t* symbols, size_t size, FrequencyTable<uint32_t> &freqs) {
+    std::vector<uint32_t> sorted(symbols, symbols + size);
+    std::sort(sorted.begin(), sorted.end());
+    freqs.data.clear();
+    for(size_t run=0; run<size;) {
+        size_t run_end = run + 1;
+        while(run_end < size && sorted[run_end] == sorted[run]) {
+            run_end++;
         }
+        freqs.data.push_back(((uint64_t)(run_end - run) << 32) | sorted[run]);
+        run = run_end;
     }
 }
 
-void choose_reuse(uint64_t n, uint64_t k, mpz_t &c, mpz_t &c1, mpz_t c2) {
-    // mpz_t's must already be initialized
-    // mpz_t c1,c2;
-    // mpz_inits(c1,c2, NULL); //opt: move inline to avoid cost of initialization every time
-    //assert k > 0
-    //if n<k return 0
-    if(n<k) {
-        mpz_set_ui(c, 0);
-        return;
-    }
-    mpz_set_ui(c1, n);
-    for(uint64_t i=n-1;i>n-k;--i) {
-        mpz_mul_ui(c1, c1, i);
-    }
-    //opt: if decrementing k by 1 every time, can reuse and divide, as in encode_symbol_location_reuse
-    mpz_fac_ui(c2, k);
-    mpz_cdiv_q(c, c1, c2);
+// Entry of each symbol in a frequency table, for the symbols used in the block
+// bytes and 16 bit symbols are looked up directly, 32 bit tokens with a binary search
+template<typename Symbol>
+struct SymbolIndex {
+    std::vector<uint64_t> sorted_symbols;   // symbol << 32 | entry, ascending
+
+    void build(FrequencyTable<Symbol> &freqs) {
+        sorted_symbols.resize(freqs.size());
+        for(size_t i=0; i<freqs.size(); i++) {
+            sorted_symbols[i] = ((uint64_t)freqs.getChar(i) << 32) | i;
+        }
+        std::sort(sorted_symbols.begin(), sorted_symbols.end());
+    }
+    size_t operator[](Symbol symbol) {
+        return (uint32_t)*std::lower_bound(sorted_symbols.begin(), sorted_symbols.end(), (uint64_t)symbol << 32);
+    }
+};
+
+template<>
+struct SymbolIndex<uint8_t> {
+    size_t entries[256];
+
+    void build(FreqChar &freqs) {
+        for(size_t i=0; i<256; i++) {
+            entries[freqs.getChar(i)] = i;
+        }
+    }
+    size_t operator[](uint8_t symbol) {
+        return entries[symbol];
+    }
+};
+
+template<>
+struct SymbolIndex<uint16_t> {
+    std::vector<uint32_t> entries;
+
+    void build(FrequencyTable<uint16_t> &freqs) {
+        entries.resize(FrequencyTable<uint16_t>::alphabet_size);
+        for(size_t i=0; i<freqs.size(); i++) {
+            entries[freqs.getChar(i)] = i;
+        }
+    }
+    size_t operator[](uint16_t symbol) {
+        return entries[symbol];
+    }
+};
+
+// Single pass over the symbols that groups every location by table entry (counting sort)
+// freqs is the symbols' frequency table (sorted or not), so they aren't counted twice
+// positions receives the locations of entry e's symbol, ascending, in [entry_start[e], entry_start[e+1])
+template<typename Symbol>
+inline void CalcSymbolPositions(const Symbol* symbols, size_t size, FrequencyTable<Symbol> &freqs, SymbolIndex<Symbol> &index, std::vector<size_t> &positions, std::vector<size_t> &entry_start) {
+    index.build(freqs);
+    entry_start.resize(freqs.size() + 1);
+    entry_start[0] = 0;
+    for(size_t e=0; e<freqs.size(); e++) {
+        entry_start[e+1] = entry_start[e] + freqs.getCount(e);
+    }
+    // next write offset of each entry
+    std::vector<size_t> next(entry_start.begin(), entry_start.end() - 1);
+    positions.resize(size);
+    for (size_t i=0; i < size; i++) {
+        positions[next[index[symbols[i]]]++] = i;
+    }
 }
 
-//clean-ver
-void encode_symbol_location_reuse(uint64_t n, uint64_t k, mpz_t symbol_accumulator, mpz_t &numerator, mpz_t &denom_fact, mpz_t &combo_result) {
-    //moved
-    // // increment k and multiply into denom_fact
-    // k += 1;
-    // mpz_mul_ui(denom_fact, denom_fact, k);
-    
-    //if n<k return 0
-    if(n<k) {
-        mpz_set_ui(combo_result, 0);
-        return;
-    }
-
-    mpz_set_ui(numerator, n);
-    for(uint64_t i=n-1;i>n-k;--i) {
-        mpz_mul_ui(numerator, numerator, i);
-    }
-    mpz_divexact(combo_result, numerator, denom_fact);
-    mpz_add(symbol_accumulator, symbol_accumulator, combo_result);
+// upper bound on the bits of n choose k, from log-gamma with a little slack for rounding
+// used to size bignums before they are built
+inline size_t binomial_bit_bound(uint64_t n, uint64_t k) {
+    if(k > n) {
+        return 1;
+    }
+    double bits = (lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0)) / M_LN2;
+    return (size_t)(bits + 1e-6) + 1;
 }
 
-//warning: overwrites combo_result
-void next_multiply_combiner(mpz_t &multiply_combiner, uint64_t n, uint64_t k, mpz_t &combo_result, mpz_t &numerator, mpz_t &denom_fact) {
-    //remaining_locations choose symbol count
-    mpz_set_ui(numerator, n);
-    for(uint64_t i=n-1;i>n-k;--i) {
-        mpz_mul_ui(numerator, numerator, i);
+// log2 of the total number of permutations of the frequency table (the multinomial of its counts)
+// the encoded value of a block is always below this many bits, rounded up
+template<typename Symbol>
+inline double permutation_bits(FrequencyTable<Symbol>& freqs) {
+    uint64_t total_symbols = 0;
+    double log_permutations = 0;
+    for(size_t i = 0; i < freqs.size(); i++) {
+        total_symbols += freqs.getCount(i);
+        log_permutations -= lgamma(freqs.getCount(i) + 1.0);
     }
-    mpz_divexact(combo_result, numerator, denom_fact);
-    mpz_mul(multiply_combiner, multiply_combiner, combo_result);
-}           
+    log_permutations += lgamma(total_symbols + 1.0);
+    return log_permutations / M_LN2;
+}
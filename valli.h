@@ -0,0 +1,100 @@
+/* Valli encoding library, C interface
+ * Encodes a message into a .vli container held in memory and back, see valli.hpp for the
+ * C++ classes behind it.  Input and output buffers are owned by the caller, an encoder or
+ * decoder can be reused for any number of messages.
+ * Build: clang++ -std=c++17 -O2 -c libvalli.cpp && ar rcs libvalli.a libvalli.o
+ * Link:  -lvalli -lgmp -pthread (and the C++ standard library)
+ */
+#ifndef VALLI_H
+#define VALLI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    VALLI_OK = 0,
+    /* output buffer too small, the required size is returned in place of the written size */
+    VALLI_ERROR_OUTPUT_TOO_SMALL,
+    /* input ends in the middle of the header or a block */
+    VALLI_ERROR_TRUNCATED,
+    /* not a .vli container of this version, or inconsistent contents */
+    VALLI_ERROR_CORRUPT,
+    /* no longer returned, every block can be encoded (blocks using all 256 byte values used to fail) */
+    VALLI_ERROR_UNSUPPORTED,
+    /* block passed to the streaming encoder doesn't match the sizes given to begin,
+     * or the input isn't a whole number of symbols */
+    VALLI_ERROR_INVALID_ARGUMENT,
+    /* allocation failed, e.g. a container declaring blocks too large for this machine */
+    VALLI_ERROR_OUT_OF_MEMORY
+} valli_status;
+
+/* pipeline stages for valli_encoder_set_stages, applied in this order before coding */
+enum {
+    VALLI_STAGE_BWT = 1,
+    VALLI_STAGE_MTF = 2,
+    VALLI_STAGE_ZERO_RUN = 4
+};
+
+typedef struct valli_encoder valli_encoder;
+typedef struct valli_decoder valli_decoder;
+
+/* block_size 0 uses the default (64000), threads 0 or 1 encodes on the calling thread
+ * returns NULL when the encoder can't be allocated */
+valli_encoder* valli_encoder_new(uint64_t block_size, size_t threads);
+/* symbols of symbol_bytes bytes each (1, 2 or 4), read little endian, e.g. 2 for UTF-16 text
+ * block_size is rounded down to a whole number of symbols, returns NULL for other widths */
+valli_encoder* valli_encoder_new_symbols(uint64_t block_size, size_t threads, int symbol_bytes);
+void valli_encoder_free(valli_encoder* encoder);
+/* nonzero ends the containers of the following valli_encode calls with a block index,
+ * so valli_decode_range only decodes the blocks it needs, off by default */
+void valli_encoder_set_block_index(valli_encoder* encoder, int enabled);
+/* nonzero codes the blocks of the following valli_encode calls with the alphabet partition tree
+ * (wavelet mode) instead of symbol by symbol, the same size, off by default */
+void valli_encoder_set_wavelet(valli_encoder* encoder, int enabled);
+/* nonzero lets every block of bytes of the following valli_encode calls be coded as one stream
+ * per context (the byte before) when that is smaller, off by default */
+void valli_encoder_set_contexts(valli_encoder* encoder, int enabled);
+/* VALLI_STAGE_* every block of bytes of the following valli_encode calls goes through before
+ * coding, kept per block only when smaller, 0 (the default) for none, other bits fail the encode */
+void valli_encoder_set_stages(valli_encoder* encoder, int stages);
+/* upper bound on the encoded size of input_size bytes, for an encoder of byte symbols */
+size_t valli_max_encoded_size(uint64_t input_size, uint64_t block_size);
+/* upper bound on the encoded size of input_size bytes with this encoder's block size and symbols */
+size_t valli_encoder_max_encoded_size(valli_encoder* encoder, uint64_t input_size);
+/* encode input into output, output_size receives the bytes written */
+valli_status valli_encode(valli_encoder* encoder, const void* input, size_t input_size,
+                          void* output, size_t output_capacity, size_t* output_size);
+
+/* threads 0 or 1 decodes on the calling thread, returns NULL when the decoder can't be allocated */
+valli_decoder* valli_decoder_new(size_t threads);
+void valli_decoder_free(valli_decoder* decoder);
+/* decoded size stored in the container header */
+valli_status valli_decoded_size(const void* input, size_t input_size, uint64_t* decoded_size);
+/* decode a whole container into output, output_size receives the bytes written */
+valli_status valli_decode(valli_decoder* decoder, const void* input, size_t input_size,
+                          void* output, size_t output_capacity, size_t* output_size);
+/* decode length bytes of the message starting at offset, input is the whole container,
+ * only the blocks covering the range are decoded (found quickly when it has a block index)
+ * a range past the end of the message returns VALLI_ERROR_INVALID_ARGUMENT */
+valli_status valli_decode_range(valli_decoder* decoder, const void* input, size_t input_size,
+                                uint64_t offset, uint64_t length,
+                                void* output, size_t output_capacity, size_t* output_size);
+/* occurrences of symbol (a byte, or a 16/32 bit value in containers of wider symbols),
+ * read from the frequency tables without decoding, blocks_containing may be NULL */
+valli_status valli_count(valli_decoder* decoder, const void* input, size_t input_size, uint32_t symbol,
+                         uint64_t* occurrences, uint64_t* blocks_containing);
+/* byte offsets of every occurrence of symbol in the decoded message, ascending, decoding each block
+ * only as far as that symbol.  found receives the number of occurrences, when it is larger than
+ * positions_capacity the first positions_capacity are written and VALLI_ERROR_OUTPUT_TOO_SMALL returned */
+valli_status valli_locate(valli_decoder* decoder, const void* input, size_t input_size, uint32_t symbol,
+                          uint64_t* positions, size_t positions_capacity, size_t* found);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1704 @@
+// Valli encoding library
+// ValliEncoder and ValliDecoder turn messages into .vli containers and back, entirely in memory:
+// input is read straight from the caller's buffer and output written into the caller's buffer.
+// Both objects keep their thread pool and scratch buffers between calls, so they can be reused
+// for any number of messages, the binomial engine's primes and cache are shared by the process.
+// Each can either do a whole message at once (encode/decode) or one block at a time
+// (begin, then encodeBlock/decodeBlock) to bound memory use on large inputs.
+// A container written with a block index can also be read a range at a time (decodeRange).
+// Symbols are bytes, or 16/32 bit little endian values picked when the encoder is built, the block
+// level work is templated on the symbol type and the decoder follows the width in the container header.
+// Blocks of bytes can go through pipeline stages (BWT, move to front, zero runs) before they are
+// coded, see pipeline-stages.hpp.
+// The C interface is in valli.h, the command line tools are thin wrappers over these classes.
+// Verbose output of the math (what the command line tools print) goes to log when it is set,
+// the per symbol and per placement detail only in builds with VALLI_TRACE=2, see trace.hpp.
+#pragma once
+
+#include <ostream>
+#include <array>
+#include <vector>
+#include <string>
+#include <stdexcept>    // out_of_range
+#include <algorithm>    // sort, min, max, fill
+#include <cstring>      // memcpy
+#include <math.h>       // log2, ceil
+#include <gmp.h>        // bigint mpz_t
+
+#include "valli.h"
+#include "utility-functions.hpp"
+#include "block-container.hpp"
+#include "removed-bitmap.hpp"
+#include "alphabet-tree.hpp"
+#include "context-streams.hpp"
+#include "pipeline-stages.hpp"
+#include "product-tree.hpp"
+#include "combinadic.hpp"
+#include "thread-pool.hpp"
+#include "native-kernel.hpp"
+#include "trace.hpp"
+
+// Statistics of the last encoded block, for verbose output
+// sizes of an order 1 block are summed over its context streams, the kernel is the last stream's
+struct ValliBlockStats {
+    uint64_t table_bytes = 0;
+    uint64_t block_bytes = 0;
+    size_t bit_length = 0;
+    size_t max_bit_length = 0;
+    // 0 for GMP, else the native word size
+    int kernel_bits = 0;
+    // context streams of an order 1 block, 0 for order 0 coding
+    size_t contexts = 0;
+    // VLI_STAGE_* the block went through
+    uint8_t stages = 0;
+};
+
+struct ValliEncoder {
+    // verbose output of the per symbol math, nothing is printed when null
+    std::ostream* log = nullptr;
+    // statistics of the last block encodeBlock wrote
+    ValliBlockStats last_block;
+    // end the container with a block index (VLI_FLAG_INDEX) so ranges can be decoded without
+    // the blocks before them, see ValliDecoder::decodeRange, set before begin
+    bool block_index = false;
+    // code blocks with the alphabet partition tree (VLI_FLAG_WAVELET, see alphabet-tree.hpp) instead
+    // of symbol by symbol, the same size with a shorter chain of smaller numbers, set before begin
+    bool wavelet = false;
+    // let every block of byte symbols pick order 1 coding, a stream per context (VLI_FLAG_CONTEXT,
+    // see context-streams.hpp), when that is smaller than a single frequency table, set before begin
+    bool contexts = false;
+    // VLI_STAGE_* every block of bytes goes through before coding (VLI_FLAG_STAGES, see pipeline-stages.hpp),
+    // a block keeps them only when that makes it smaller, set before begin
+    uint8_t stages = 0;
+
+    // thread_count <= 1 runs everything on the calling thread
+    // symbol_bytes is the width of a symbol: 1 (bytes), 2 (UTF-16 text, 16 bit samples) or 4 (tokens),
+    // wider symbols are read little endian and the block size is rounded down to a whole number of them
+    explicit ValliEncoder(uint64_t block_size = VLI_DEFAULT_BLOCK_SIZE, size_t thread_count = 1, int symbol_bytes = 1)
+        : block_size(blockSizeFor(block_size, symbol_bytes)), symbol_bytes(validSymbolBytes(symbol_bytes) ? symbol_bytes : 1),
+          pool(thread_count > 1 ? thread_count : 0) {}
+
+    uint64_t blockSize() {
+        return block_size;
+    }
+    int symbolBytes() {
+        return symbol_bytes;
+    }
+    static bool validSymbolBytes(int symbol_bytes) {
+        return symbol_bytes == 1 || symbol_bytes == 2 || symbol_bytes == 4;
+    }
+
+    // upper bound on the container size for input_size bytes, to size the output buffer
+    static uint64_t maxEncodedSize(uint64_t input_size, uint64_t block_size = VLI_DEFAULT_BLOCK_SIZE, int symbol_bytes = 1) {
+        block_size = blockSizeFor(block_size, symbol_bytes);
+        uint64_t block_count = (input_size + block_size - 1) / block_size;
+        // a block's value is below (symbols)^(length), so never more bytes than the block
+        return VLI_MAX_HEADER_BYTES + input_size + block_count * (maxBlockSize(block_size, symbol_bytes) - block_size) + max_index_bytes(block_count);
+    }
+    // upper bound on the bytes encodeBlock writes for a block of block_length bytes
+    static uint64_t maxBlockSize(uint64_t block_length, int symbol_bytes = 1) {
+        if(!validSymbolBytes(symbol_bytes)) {
+            symbol_bytes = 1;
+        }
+        // stages and order 1 coding are only picked when smaller, the stages and coding bytes are the only extra
+        return 2 + block_length + max_table_bytes(symbol_bytes, block_length / symbol_bytes) + 10;
+    }
+
+    // Streaming: write the container header for a message of total_size bytes.
+    // Then call encodeBlock for every block, all of them blockSize() bytes except the last, and finish.
+    valli_status begin(uint64_t total_size, unsigned char* output, size_t capacity, size_t* written) {
+        header = ContainerHeader();
+        header.symbol_bytes = symbol_bytes;
+        header.flags = (block_index ? VLI_FLAG_INDEX : 0) | (wavelet ? VLI_FLAG_WAVELET : 0) | (contexts ? VLI_FLAG_CONTEXT : 0) | (stages ? VLI_FLAG_STAGES : 0);
+        header.block_size = block_size;
+        header.total_size = total_size;
+        header.block_count = (total_size + block_size - 1) / block_size;
+        remaining_size = total_size;
+        *written = 0;
+        // only whole symbols, and stages this encoder has
+        if(total_size % symbol_bytes != 0 || (stages & ~VLI_KNOWN_STAGES)) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        ByteWriter writer(output, capacity);
+        header.write(writer);
+        *written = writer.size;
+        header_bytes = writer.size;
+        block_bytes.clear();
+        return writer.overflowed() ? VALLI_ERROR_OUTPUT_TOO_SMALL : VALLI_OK;
+    }
+
+    // Streaming: encode the next block of the message given to begin.
+    // On VALLI_ERROR_OUTPUT_TOO_SMALL, written is the size needed and the block is not consumed.
+    valli_status encodeBlock(const char* input, size_t input_size, unsigned char* output, size_t capacity, size_t* written) {
+        *written = 0;
+        if(input_size != std::min(block_size, remaining_size) || input_size == 0) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        if(symbol_bytes == 2) {
+            return encodeBlockAs<uint16_t>(input, input_size, output, capacity, written);
+        }
+        if(symbol_bytes == 4) {
+            return encodeBlockAs<uint32_t>(input, input_size, output, capacity, written);
+        }
+        return encodeBlockAs<uint8_t>(input, input_size, output, capacity, written);
+    }
+
+    // Streaming: after the last block, write the block index when block_index was set when begin
+    // was called, nothing otherwise.
+    valli_status finish(unsigned char* output, size_t capacity, size_t* written) {
+        *written = 0;
+        if(remaining_size != 0 || block_bytes.size() != header.block_count) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        if(!(header.flags & VLI_FLAG_INDEX)) {
+            return VALLI_OK;
+        }
+        uint64_t index_offset = header_bytes;
+        for(uint64_t bytes : block_bytes) {
+            index_offset += bytes;
+        }
+        ByteWriter writer(output, capacity);
+        write_block_index(writer, block_bytes, index_offset);
+        *written = writer.size;
+        return writer.overflowed() ? VALLI_ERROR_OUTPUT_TOO_SMALL : VALLI_OK;
+    }
+
+    // Encode a whole message, maxEncodedSize(input_size, blockSize(), symbolBytes()) bytes of output are always enough.
+    valli_status encode(const char* input, size_t input_size, unsigned char* output, size_t capacity, size_t* written) {
+        size_t header_written;
+        valli_status status = begin(input_size, output, capacity, &header_written);
+        size_t total_written = header_written;
+        for(uint64_t offset = 0; status == VALLI_OK && offset < input_size; offset += block_size) {
+            size_t block_length = std::min<uint64_t>(block_size, input_size - offset);
+            size_t block_written;
+            status = encodeBlock(input + offset, block_length, output + total_written, capacity - total_written, &block_written);
+            total_written += block_written;
+        }
+        if(status == VALLI_OK) {
+            size_t index_written;
+            status = finish(output + total_written, capacity - total_written, &index_written);
+            total_written += index_written;
+        }
+        *written = total_written;
+        return status;
+    }
+
+  private:
+    // Per digit layout of a block shared by the encoding kernels, filled by pass 1 in encodeBlockValue
+    struct BlockDigits {
+        // start of each digit's locations in locs, its symbol count and remaining locations
+        std::vector<size_t> digit_start;
+        std::vector<uint64_t> digit_count_of;
+        std::vector<uint64_t> digit_remaining;
+        // location of each symbol instance among the locations remaining when its symbol is encoded
+        std::vector<size_t> locs;
+        // symbol instances that are encoded (all but the last symbol's)
+        uint64_t encoded_instances = 0;
+        // bits of the total permutations, rounded up, from the frequency table
+        size_t max_bit_bound = 0;
+    };
+
+    uint64_t block_size;
+    int symbol_bytes;
+    ThreadPool pool;
+    // streaming state
+    ContainerHeader header;
+    uint64_t remaining_size = 0;
+    uint64_t header_bytes = 0;
+    // container bytes of every block written so far, for the block index
+    std::vector<uint64_t> block_bytes;
+    // scratch kept between blocks and messages
+    BlockDigits digits;
+    std::vector<size_t> positions;
+    std::vector<size_t> entry_start;
+    std::vector<unsigned char> payload;
+    // wavelet mode: the tree, its leaf counts and the entry of every location on two levels
+    AlphabetTree tree;
+    std::vector<uint64_t> tree_counts;
+    std::vector<uint32_t> tree_entries;
+    std::vector<uint32_t> tree_scratch;
+    // order 1 coding: the block's context streams, stream c from context_start[c]
+    std::vector<uint8_t> context_streams;
+    std::array<uint64_t, CONTEXT_COUNT + 1> context_start;
+    // stages: the pipeline and the parameters of the current block's stages
+    StagePipeline pipeline;
+    std::vector<uint64_t> stage_parameters;
+    // wider symbols of the current block, read from the input
+    std::vector<uint16_t> symbols16;
+    std::vector<uint32_t> symbols32;
+
+    // block size rounded down to whole symbols
+    static uint64_t blockSizeFor(uint64_t block_size, int symbol_bytes) {
+        if(!validSymbolBytes(symbol_bytes)) {
+            symbol_bytes = 1;
+        }
+        if(block_size == 0) {
+            block_size = VLI_DEFAULT_BLOCK_SIZE;
+        }
+        return std::max<uint64_t>(symbol_bytes, block_size - block_size % symbol_bytes);
+    }
+
+    // the block's symbols, bytes are used in place, wider symbols are read little endian into scratch
+    const uint8_t* blockSymbols(const char* input, size_t, uint8_t*) {
+        return (const uint8_t*)input;
+    }
+    const uint16_t* blockSymbols(const char* input, size_t symbol_count, uint16_t*) {
+        symbols16.resize(symbol_count);
+        for(size_t i = 0; i < symbol_count; i++) {
+            symbols16[i] = load_symbol<uint16_t>(input, i);
+        }
+        return symbols16.data();
+    }
+    const uint32_t* blockSymbols(const char* input, size_t symbol_count, uint32_t*) {
+        symbols32.resize(symbol_count);
+        for(size_t i = 0; i < symbol_count; i++) {
+            symbols32[i] = load_symbol<uint32_t>(input, i);
+        }
+        return symbols32.data();
+    }
+
+    // encodeBlock for Symbol sized symbols
+    template<typename Symbol>
+    valli_status encodeBlockAs(const char* input, size_t input_size, unsigned char* output, size_t capacity, size_t* written) {
+        VALLI_TRACE_BLOCK_BEGIN(false);
+        size_t symbol_count = input_size / sizeof(Symbol);
+        const Symbol* symbols = blockSymbols(input, symbol_count, (Symbol*)nullptr);
+        ByteWriter writer(output, capacity);
+        // with VLI_FLAG_STAGES the block starts with the stages it went through and their parameters
+        uint8_t applied_stages = 0;
+        if(header.flags & VLI_FLAG_STAGES) {
+            applied_stages = applyStages(symbols, symbol_count);
+            writer << applied_stages;
+            for(uint64_t parameter : stage_parameters) {
+                write_varint(writer, parameter);
+            }
+        }
+        // then with VLI_FLAG_CONTEXT its coding
+        bool order1 = (header.flags & VLI_FLAG_CONTEXT) && contextsPayOff(symbols, symbol_count);
+        if(header.flags & VLI_FLAG_CONTEXT) {
+            writer << (order1 ? VLI_CODING_ORDER1 : VLI_CODING_ORDER0);
+        }
+        if(order1) {
+            encodeContexts(writer);
+            VALLI_TRACE_BLOCK_SET(length, symbol_count);
+        } else {
+            FrequencyTable<Symbol> freqs;
+            encodeBlockValue(symbols, symbol_count, freqs);
+            VALLI_TRACE_CLOCK(trace_clock);
+            write_block(writer, freqs, payload, last_block.table_bytes);
+            last_block.contexts = 0;
+            VALLI_TRACE_LAP(trace_clock, TRACE_EXPORT);
+            VALLI_TRACE_BLOCK_SET(payload_bytes, payload.size());
+        }
+        last_block.stages = applied_stages;
+        last_block.block_bytes = writer.size;
+        *written = writer.size;
+        if(writer.overflowed()) {
+            return VALLI_ERROR_OUTPUT_TOO_SMALL;
+        }
+        VALLI_TRACE_BLOCK_SET(table_bytes, last_block.table_bytes);
+        VALLI_TRACE_BLOCK_END();
+        if(log) {
+            if(header.flags & VLI_FLAG_STAGES) {
+                *log << "Stages: " << StagePipeline::names(applied_stages) << std::endl;
+            }
+            if(header.flags & VLI_FLAG_CONTEXT) {
+                *log << "Coding: " << (order1 ? "order 1, " + std::to_string(last_block.contexts) + " contexts" : std::string("order 0")) << std::endl;
+            }
+            *log << "Frequency table size (bytes): " << last_block.table_bytes << std::endl;
+            *log << "Block size with table (bytes): " << last_block.block_bytes << std::endl;
+        }
+        remaining_size -= input_size;
+        block_bytes.push_back(writer.size);
+        return VALLI_OK;
+    }
+
+    // Stages only for bytes: run the block through the encoder's stages and keep the result when its
+    // size bound (with the stage parameters) is below the block's own, symbols and symbol_count then
+    // point at the transformed bytes, returns the stages applied
+    uint8_t applyStages(const uint8_t*& symbols, size_t& symbol_count) {
+        stage_parameters.clear();
+        // the BWT's suffix array has 32 bit entries
+        if(symbol_count > UINT32_MAX) {
+            return 0;
+        }
+        VALLI_TRACE_CLOCK(trace_clock);
+        const std::vector<uint8_t>& staged = pipeline.forward(stages, symbols, symbol_count, stage_parameters);
+        VALLI_TRACE_LAP(trace_clock, TRACE_STAGES);
+        FreqChar plain_freqs, staged_freqs;
+        CalcFrequencyPairs(symbols, symbol_count, plain_freqs);
+        plain_freqs.sortData();
+        CalcFrequencyPairs(staged.data(), staged.size(), staged_freqs);
+        staged_freqs.sortData();
+        uint64_t plain = coded_size_bound(plain_freqs);
+        uint64_t transformed = coded_size_bound(staged_freqs);
+        for(uint64_t parameter : stage_parameters) {
+            transformed += varint_bytes(parameter);
+        }
+        if(log) {
+            *log << "Bound without stages (bytes): " << plain << ", with stages (bytes): " << transformed << std::endl;
+        }
+        if(transformed >= plain) {
+            stage_parameters.clear();
+            return 0;
+        }
+        symbols = staged.data();
+        symbol_count = staged.size();
+        return stages;
+    }
+    template<typename Symbol>
+    uint8_t applyStages(const Symbol*&, size_t&) {
+        stage_parameters.clear();
+        return 0;
+    }
+
+    // Order 1 coding only for bytes: split the block into context streams (kept for encodeContexts)
+    // and compare the size bounds of both codings
+    bool contextsPayOff(const uint8_t* symbols, size_t symbol_count) {
+        context_split(symbols, symbol_count, context_streams, context_start);
+        uint64_t order0, order1;
+        context_size_bounds(symbols, symbol_count, context_streams, context_start, order0, order1);
+        if(log) {
+            *log << "Order 0 bound (bytes): " << order0 << ", order 1 bound (bytes): " << order1 << std::endl;
+        }
+        return order1 < order0;
+    }
+    template<typename Symbol>
+    bool contextsPayOff(const Symbol*, size_t) {
+        return false;
+    }
+
+    // Order 1: the context count, then every context stream of the last contextsPayOff coded
+    // like a block after its context, the streams are independent
+    void encodeContexts(ByteWriter& writer) {
+        size_t used = 0;
+        for(size_t c = 0; c < CONTEXT_COUNT; c++) {
+            used += context_start[c + 1] > context_start[c];
+        }
+        write_varint(writer, used);
+        ValliBlockStats stats;
+        for(size_t c = 0; c < CONTEXT_COUNT; c++) {
+            uint64_t length = context_start[c + 1] - context_start[c];
+            if(length == 0) {
+                continue;
+            }
+            if(log) {
+                *log << "------ Context " << c << " ------" << std::endl;
+            }
+            FreqChar freqs;
+            encodeBlockValue(context_streams.data() + context_start[c], length, freqs);
+            VALLI_TRACE_CLOCK(trace_clock);
+            writer << (uint8_t)c;
+            uint64_t table_bytes;
+            write_block(writer, freqs, payload, table_bytes);
+            VALLI_TRACE_LAP(trace_clock, TRACE_EXPORT);
+            stats.table_bytes += table_bytes;
+            stats.bit_length += last_block.bit_length;
+            stats.max_bit_length += last_block.max_bit_length;
+            stats.kernel_bits = last_block.kernel_bits;
+        }
+        stats.contexts = used;
+        last_block = stats;
+    }
+
+    // Encode a single block into payload, any block can be encoded
+    // freqs receives the sorted frequency table
+    template<typename Symbol>
+    void encodeBlockValue(const Symbol* buffer, size_t buffer_size, FrequencyTable<Symbol>& freqs) {
+        VALLI_TRACE_CLOCK(trace_clock);
+        // count the frequencies of each symbol
+        CalcFrequencyPairs(buffer, buffer_size, freqs);
+        VALLI_TRACE_LAP(trace_clock, TRACE_HISTOGRAM);
+
+        //sort the frequency table, ascending by count then symbol
+        freqs.sortData();
+        VALLI_TRACE_LAP(trace_clock, TRACE_SORT);
+
+        if(log) {
+            *log << "Sorted Frequencies:" << std::endl;
+            *log << (sizeof(Symbol) == 1 ? "idx : chr : int : count" : "idx : int : count") << std::endl;
+        }
+        // print non-zero frequencies and count unique symbols
+        uint64_t unique_symbols = 0;
+        for (size_t i = 0; i < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                unique_symbols++;
+                if(log) {
+                    *log << i << " : ";
+                    if(sizeof(Symbol) == 1) {
+                        *log << "'" << (char)freqs.getChar(i) << "' : ";
+                    }
+                    *log << (uint)freqs.getChar(i) << " : " << freqs.getCount(i) << std::endl;
+                }
+            }
+        }
+        uint64_t total_symbols = buffer_size;
+        VALLI_TRACE_BLOCK_SET(length, total_symbols);
+        VALLI_TRACE_BLOCK_SET(unique_symbols, unique_symbols);
+
+        if(log) {
+            *log << "==============================" << std::endl;
+            *log << "Total symbols: " << total_symbols << std::endl;
+            *log << "Unique symbols: " << unique_symbols << std::endl;
+            *log << "------------------------------" << std::endl;
+        }
+
+        // A block with a single unique symbol is fully described by its frequency table,
+        // it has no digits and the encoded value stays 0.
+
+        // one digit per symbol, or per node of the alphabet partition tree
+        if(header.flags & VLI_FLAG_WAVELET) {
+            layoutTree(buffer, buffer_size, freqs);
+        } else {
+            layoutSymbols(buffer, buffer_size, freqs, unique_symbols);
+        }
+        digits.max_bit_bound = (size_t)(permutation_bits(freqs) + 1e-6) + 1;
+        VALLI_TRACE_LAP(trace_clock, TRACE_POSITIONS);
+
+        // Blocks whose total permutations fit in a machine word skip GMP entirely,
+        // the word size only depends on the frequency table so the decoder makes the same choice
+        size_t bit_length = 0;
+        size_t max_bit_length = 0;
+        int word_bits = native_word_bits(freqs);
+        bool native_encoded = false;
+        if(word_bits == 64) {
+            native_encoded = encodeDigitsNative<uint64_t>(bit_length, max_bit_length);
+        } else if(word_bits == 128) {
+            native_encoded = encodeDigitsNative<unsigned __int128>(bit_length, max_bit_length);
+        }
+        if(!native_encoded) {
+            encodeDigitsGmp(bit_length, max_bit_length);
+        }
+        last_block.bit_length = bit_length;
+        last_block.max_bit_length = max_bit_length;
+        last_block.kernel_bits = native_encoded ? word_bits : 0;
+        VALLI_TRACE_BLOCK_SET(kernel_bits, last_block.kernel_bits);
+        VALLI_TRACE_BLOCK_SET(value_bits, bit_length);
+        VALLI_TRACE_BLOCK_SET(max_bits, max_bit_length);
+
+        if(log) {
+            *log << "Kernel: " << (native_encoded ? std::to_string(word_bits) + " bit" : std::string("GMP")) << std::endl;
+
+            // Verbose: statistics around the output
+            *log << "Current byte length: " << ceil(bit_length/8.0) << std::endl;
+            *log << "Current bit length: " << bit_length << std::endl;
+            *log << "Max bit length: " << max_bit_length << std::endl;
+
+            // Calculate the Shannon minimum bit length, static frequency table
+            // = shannon entropy per symbol * message length
+            double shannon_entropy = 0.0;
+            for (size_t i = 0; i < freqs.size(); i++) {
+                if(freqs.getCount(i)) {
+                    double probability = static_cast<double>(freqs.getCount(i)) / total_symbols;
+                    shannon_entropy -= probability * log2(probability);
+                }
+            }
+            shannon_entropy = shannon_entropy * total_symbols;
+
+            *log << "Static frequency Shannon limit: " << ceil(shannon_entropy) << std::endl;
+            *log << "Bits saved: " << ceil(shannon_entropy)-max_bit_length << std::endl;
+            *log << "Relative Size: " << 100 * (max_bit_length / ceil(shannon_entropy)) << "%" << std::endl;
+        }
+    }
+
+    // Fill digits with one digit per symbol but the last, the location of each instance among the
+    // locations the symbols before it left
+    template<typename Symbol>
+    void layoutSymbols(const Symbol* buffer, size_t buffer_size, FrequencyTable<Symbol>& freqs, uint64_t unique_symbols) {
+        uint64_t total_symbols = buffer_size;
+        // Every symbol value can be used: the frequency table leaves out its terminating zero count
+        // when the whole alphabet is used, and removed locations are tracked in a bitmap
+        // instead of being overwritten with an unused symbol.
+        uint64_t remaining_loc = total_symbols;
+
+        // One pass over the buffer to find the locations of every symbol,
+        // instead of rescanning the whole buffer for each unique symbol.
+        SymbolIndex<Symbol> symbol_index;
+        CalcSymbolPositions(buffer, buffer_size, freqs, symbol_index, positions, entry_start);
+        // Locations of already encoded symbols are removed from the count of possible locations,
+        // each symbol's ascending locations sweep the bitmap once to count the removed ones before them
+        RemovedBitmap removed_locs;
+        removed_locs.reset(total_symbols);
+
+        // Each encoded symbol's sum of binomials is a digit of a mixed radix number,
+        // its radix is the number of ways the symbol could be placed.
+        // All symbols except the last (most frequent) are encoded.
+        size_t digit_count = unique_symbols ? unique_symbols-1 : 0;
+        // locs has the same layout as positions
+        digits.digit_start.resize(digit_count);
+        digits.digit_count_of.resize(digit_count);
+        digits.digit_remaining.resize(digit_count);
+        digits.locs.resize(total_symbols);
+
+        // Pass 1 (sequential): the only dependency between symbols is which locations
+        // earlier symbols removed, resolve that for every symbol first.
+        // Loop through each table entry
+        // size-1 because the last symbol (asc sort) does not need to be encoded/decoded
+        size_t digit_idx = 0;
+        for (size_t i = 0; i + 1 < freqs.size(); i++) {
+            // if character exists in message
+            if(freqs.getCount(i)) {
+                //calculate location for first item
+                VALLI_TRACE_DETAIL(if(log) {
+                    *log << "--- " << (char)freqs.getChar(i) << ":" << freqs.getCount(i) << " (" << (uint)freqs.getChar(i) << ")" << " ---" << std::endl;
+                })
+                VALLI_TRACE_SYMBOL(freqs.getChar(i), freqs.getCount(i), remaining_loc, binomial_bit_bound(remaining_loc, freqs.getCount(i)));
+
+                digits.digit_start[digit_idx] = entry_start[i];
+                digits.digit_count_of[digit_idx] = freqs.getCount(i);
+                digits.digit_remaining[digit_idx] = remaining_loc;
+                uint64_t symbol_count = 1;
+                RemovedBitmap::Sweep removed_before(removed_locs);
+                for(size_t pos_idx = entry_start[i]; pos_idx < entry_start[i+1]; pos_idx++) {
+                    size_t symbol_loc = positions[pos_idx];
+                    // location among the ones remaining, earlier instances of the current symbol still count
+                    digits.locs[pos_idx] = symbol_loc - removed_before.removedBefore(symbol_loc);
+                    // verbose: combination calculation for location choose symbol_count
+                    VALLI_TRACE_DETAIL(if(log) {
+                        *log << " + " << digits.locs[pos_idx] << " choose " << symbol_count << std::endl;
+                    })
+                    symbol_count++;
+                }
+                // remove the current symbol's locations for the following symbols
+                for(size_t pos_idx = entry_start[i]; pos_idx < entry_start[i+1]; pos_idx++) {
+                    removed_locs.remove(positions[pos_idx]);
+                }
+                //track how many possible locations remain without the current symbol
+                remaining_loc -= freqs.getCount(i);
+                digit_idx++;
+            }
+        }
+
+        digits.encoded_instances = total_symbols - remaining_loc;
+    }
+
+    // Wavelet mode: fill digits with one digit per node of the alphabet partition tree,
+    // the locations of its first half among the node's locations
+    template<typename Symbol>
+    void layoutTree(const Symbol* buffer, size_t buffer_size, FrequencyTable<Symbol>& freqs) {
+        // the used entries, numbered in table order
+        tree_counts.clear();
+        std::vector<uint32_t> used_entry(freqs.size());
+        for(size_t i = 0; i < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                used_entry[i] = tree_counts.size();
+                tree_counts.push_back(freqs.getCount(i));
+            }
+        }
+        tree.build(tree_counts);
+        size_t node_count = tree.nodes.size();
+        digits.digit_start.resize(node_count);
+        digits.digit_count_of.resize(node_count);
+        digits.digit_remaining.resize(node_count);
+        uint64_t instances = 0;
+        for(size_t node_idx = 0; node_idx < node_count; node_idx++) {
+            AlphabetTree::Node& node = tree.nodes[node_idx];
+            digits.digit_start[node_idx] = instances;
+            digits.digit_count_of[node_idx] = node.left_locations;
+            digits.digit_remaining[node_idx] = node.locations;
+            VALLI_TRACE_SYMBOL(node_idx, node.left_locations, node.locations, binomial_bit_bound(node.locations, node.left_locations));
+            instances += node.left_locations;
+        }
+        digits.locs.resize(instances);
+        digits.encoded_instances = instances;
+        // the entry of every location, the root level of the partition
+        SymbolIndex<Symbol> symbol_index;
+        symbol_index.build(freqs);
+        tree_entries.resize(buffer_size);
+        for(size_t i = 0; i < buffer_size; i++) {
+            tree_entries[i] = used_entry[symbol_index[buffer[i]]];
+        }
+        tree.partition(tree_entries, tree_scratch, digits.locs, digits.digit_start);
+    }
+
+    // GMP kernel: sums of binomials on the pool's threads, combined with a product tree
+    // bit_length and max_bit_length receive the sizes of the encoded value and of the total permutations
+    void encodeDigitsGmp(size_t& bit_length, size_t& max_bit_length) {
+        VALLI_TRACE_CLOCK(trace_clock);
+        size_t digit_count = digits.digit_count_of.size();
+        MpzArray symbol_digits(digit_count);
+        MpzArray symbol_radices(digit_count);
+        // every value's size is known up front from its radix, size them once instead of growing
+        std::vector<size_t> radix_bits(digit_count);
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            radix_bits[digit_idx] = binomial_bit_bound(digits.digit_remaining[digit_idx], digits.digit_count_of[digit_idx]);
+            mpz_realloc2(symbol_digits[digit_idx], radix_bits[digit_idx]);
+            mpz_realloc2(symbol_radices[digit_idx], radix_bits[digit_idx]);
+        }
+
+        // Pass 2 (parallel): every symbol's sum of binomials only depends on its own locations.
+        // Symbols with many instances are split into ranges of instances whose partial sums are
+        // added together at the end, so one frequent symbol doesn't serialize the block.
+        uint64_t range_size = digits.encoded_instances;
+        if(pool.size() > 1) {
+            // a few ranges per thread lets work stealing even out the uneven cost of the ranges
+            range_size = std::max<uint64_t>(1024, digits.encoded_instances / (pool.size() * 4));
+        }
+        // sieve the primes the binomial engine needs for this block before the tasks share it
+        binomial_engine().prepare(digits.digit_remaining.empty() ? 0 : digits.digit_remaining[0]);
+        std::vector<size_t> range_digit;
+        std::vector<uint64_t> range_first;
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            for(uint64_t first = 0; first < digits.digit_count_of[digit_idx]; first += range_size) {
+                range_digit.push_back(digit_idx);
+                range_first.push_back(first);
+            }
+        }
+        MpzArray range_sums(range_digit.size());
+        for(size_t range_idx = 0; range_idx < range_digit.size(); range_idx++) {
+            mpz_realloc2(range_sums[range_idx], radix_bits[range_digit[range_idx]]);
+        }
+        for(size_t range_idx = 0; range_idx < range_digit.size(); range_idx++) {
+            pool.submit([&, range_idx] {
+                size_t digit = range_digit[range_idx];
+                uint64_t first = range_first[range_idx];
+                uint64_t last = std::min(first + range_size, digits.digit_count_of[digit]);
+                VALLI_TRACE_CLOCK(task_clock);
+                // sums the binomials of a symbol, reusing each term to build the next one
+                CombinationRanker ranker(radix_bits[digit]);
+                for(uint64_t instance = first; instance < last; instance++) {
+                    ranker.add(digits.locs[digits.digit_start[digit] + instance], instance + 1, range_sums[range_idx]);
+                }
+                VALLI_TRACE_SYMBOL_LAP(task_clock, digit);
+            });
+        }
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            pool.submit([&, digit_idx] {
+                VALLI_TRACE_CLOCK(task_clock);
+                // calculation is needed for the combination and the 'max bit length' calculation at the end
+                binomial_engine().binomial(symbol_radices[digit_idx], digits.digit_remaining[digit_idx], digits.digit_count_of[digit_idx]);
+                VALLI_TRACE_SYMBOL_LAP(task_clock, digit_idx);
+            });
+        }
+        pool.wait();
+
+        // reduce the partial sums of each symbol
+        for(size_t range_idx = 0; range_idx < range_digit.size(); range_idx++) {
+            mpz_add(symbol_digits[range_digit[range_idx]], symbol_digits[range_digit[range_idx]], range_sums[range_idx]);
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_RANK);
+        VALLI_TRACE_DETAIL(if(log) {
+            for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+                // verbose output: sum of binomials
+                *log << "Sum of Binomials: " << mpz_string(symbol_digits[digit_idx]) << " " << std::endl;
+            }
+        })
+
+        // combine all symbol digits with a balanced product tree of the radices
+        ProductTree combiner;
+        combiner.build(symbol_radices);
+        mpz_t data_accumulator;
+        mpz_init2(data_accumulator, digits.max_bit_bound);
+        combiner.combine(symbol_digits, data_accumulator);
+        VALLI_TRACE_LAP(trace_clock, TRACE_COMBINE);
+
+        // Verbose: output the final integer
+        VALLI_TRACE_DETAIL(if(log) {
+            *log << "----------Final Data----------" << std::endl;
+            *log << mpz_string(data_accumulator) << " " << std::endl;
+            *log << "------------------------------" << std::endl;
+        })
+
+        bit_length = mpz_sizeinbase(data_accumulator, 2);
+        // Use combiner to calc max bit len (total # of permutations of symbol frequencies)
+        max_bit_length = mpz_sizeinbase(combiner.total(), 2);
+        mpz_to_payload(data_accumulator, payload);
+        mpz_clear(data_accumulator);
+        VALLI_TRACE_LAP(trace_clock, TRACE_EXPORT);
+    }
+
+    // Native kernel for blocks whose total permutations fit in a Word, same value as the GMP kernel
+    // returns false if a value turns out not to fit, the caller falls back to GMP
+    template<typename Word>
+    bool encodeDigitsNative(size_t& bit_length, size_t& max_bit_length) {
+        typedef NativeKernel<Word> Kernel;
+        VALLI_TRACE_CLOCK(trace_clock);
+        size_t digit_count = digits.digit_count_of.size();
+        std::vector<Word> symbol_radices;
+        Word total;
+        if(!Kernel::radices(digits.digit_remaining, digits.digit_count_of, symbol_radices, total)) {
+            return false;
+        }
+        // at most a few dozen instances per symbol fit, no need for the pool
+        std::vector<Word> symbol_digits(digit_count);
+        VALLI_TRACE_CLOCK(symbol_clock);
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            if(!Kernel::rank(&digits.locs[digits.digit_start[digit_idx]], digits.digit_count_of[digit_idx], symbol_digits[digit_idx])) {
+                return false;
+            }
+            VALLI_TRACE_SYMBOL_LAP(symbol_clock, digit_idx);
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_RANK);
+        VALLI_TRACE_DETAIL(if(log) {
+            for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+                // verbose output: sum of binomials
+                *log << "Sum of Binomials: " << Kernel::toString(symbol_digits[digit_idx]) << " " << std::endl;
+            }
+        })
+        Word data_accumulator = Kernel::combine(symbol_digits, symbol_radices);
+        VALLI_TRACE_LAP(trace_clock, TRACE_COMBINE);
+
+        // Verbose: output the final integer
+        VALLI_TRACE_DETAIL(if(log) {
+            *log << "----------Final Data----------" << std::endl;
+            *log << Kernel::toString(data_accumulator) << " " << std::endl;
+            *log << "------------------------------" << std::endl;
+        })
+
+        bit_length = Kernel::bitLength(data_accumulator);
+        max_bit_length = Kernel::bitLength(total);
+        Kernel::toPayload(data_accumulator, payload);
+        VALLI_TRACE_LAP(trace_clock, TRACE_EXPORT);
+        return true;
+    }
+};
+
+struct ValliDecoder {
+    // verbose output of the per symbol math, nothing is printed when null
+    std::ostream* log = nullptr;
+    // header of the container given to begin
+    ContainerHeader header;
+
+    // thread_count <= 1 runs everything on the calling thread
+    explicit ValliDecoder(size_t thread_count = 1) : pool(thread_count > 1 ? thread_count : 0) {}
+
+    // decoded size stored in a container's header
+    static valli_status decodedSize(const unsigned char* input, size_t input_size, uint64_t* decoded_size) {
+        ByteReader reader(input, input_size);
+        ContainerHeader container_header;
+        if(!container_header.read(reader)) {
+            return reader.failed ? VALLI_ERROR_TRUNCATED : VALLI_ERROR_CORRUPT;
+        }
+        *decoded_size = container_header.total_size;
+        return VALLI_OK;
+    }
+
+    // Streaming: read the container header, consumed receives its size.
+    // Then call decodeBlock header.block_count times with the following bytes.
+    valli_status begin(const unsigned char* input, size_t input_size, size_t* consumed) {
+        *consumed = 0;
+        ByteReader reader(input, input_size);
+        header = ContainerHeader();
+        if(!header.read(reader)) {
+            return reader.failed ? VALLI_ERROR_TRUNCATED : VALLI_ERROR_CORRUPT;
+        }
+        if(header.block_size == 0 || header.block_count != (header.total_size + header.block_size - 1) / header.block_size
+           || header.block_size % header.symbol_bytes != 0 || header.total_size % header.symbol_bytes != 0) {
+            return VALLI_ERROR_CORRUPT;
+        }
+        remaining_blocks = header.block_count;
+        remaining_size = header.total_size;
+        *consumed = reader.position;
+        return VALLI_OK;
+    }
+
+    // begin for a whole container in memory (the functions below all start with it), also
+    // rejects a header declaring more blocks than input_size bytes can hold, before anything is
+    // sized from it
+    valli_status beginContainer(const unsigned char* input, size_t input_size, size_t* consumed) {
+        valli_status status = begin(input, input_size, consumed);
+        if(status == VALLI_OK && !header_fits(header, *consumed, input_size)) {
+            *consumed = 0;
+            return VALLI_ERROR_TRUNCATED;
+        }
+        return status;
+    }
+
+    // Streaming: decode the next block, input starts at the block, consumed receives its size.
+    // On VALLI_ERROR_TRUNCATED nothing is consumed, call again with more input.
+    // On VALLI_ERROR_OUTPUT_TOO_SMALL written is the size needed and nothing is consumed.
+    valli_status decodeBlock(const unsigned char* input, size_t input_size, size_t* consumed, char* output, size_t capacity, size_t* written) {
+        *consumed = 0;
+        *written = 0;
+        if(remaining_blocks == 0) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        if(header.symbol_bytes == 2) {
+            return decodeBlockAs<uint16_t>(input, input_size, consumed, output, capacity, written);
+        }
+        if(header.symbol_bytes == 4) {
+            return decodeBlockAs<uint32_t>(input, input_size, consumed, output, capacity, written);
+        }
+        return decodeBlockAs<uint8_t>(input, input_size, consumed, output, capacity, written);
+    }
+
+    // Decode a whole container, output needs room for the decoded size (see decodedSize)
+    valli_status decode(const unsigned char* input, size_t input_size, char* output, size_t capacity, size_t* written) {
+        *written = 0;
+        size_t consumed;
+        valli_status status = beginContainer(input, input_size, &consumed);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        if(header.total_size > capacity) {
+            *written = header.total_size;
+            return VALLI_ERROR_OUTPUT_TOO_SMALL;
+        }
+        size_t input_offset = consumed;
+        size_t total_written = 0;
+        while(remaining_blocks > 0) {
+            size_t block_written;
+            status = decodeBlock(input + input_offset, input_size - input_offset, &consumed, output + total_written, capacity - total_written, &block_written);
+            if(status != VALLI_OK) {
+                return status;
+            }
+            input_offset += consumed;
+            total_written += block_written;
+        }
+        *written = total_written;
+        return VALLI_OK;
+    }
+
+    // Random access: decode the length bytes of the message starting at offset into output,
+    // input is the whole container.  Only the blocks covering the range are decoded, they are
+    // found through the block index when the container has one (VLI_FLAG_INDEX), otherwise by
+    // reading the frequency table and payload length of every block before them, which skips the
+    // payloads but still touches each block.
+    valli_status decodeRange(const unsigned char* input, size_t input_size, uint64_t offset, uint64_t length, char* output, size_t capacity, size_t* written) {
+        *written = 0;
+        size_t header_bytes;
+        valli_status status = beginContainer(input, input_size, &header_bytes);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        if(offset > header.total_size || length > header.total_size - offset) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        if(length > capacity) {
+            *written = length;
+            return VALLI_ERROR_OUTPUT_TOO_SMALL;
+        }
+        if(length == 0) {
+            return VALLI_OK;
+        }
+        uint64_t first_block = offset / header.block_size;
+        uint64_t last_block = (offset + length - 1) / header.block_size;
+        status = findBlocks(input, input_size, header_bytes, last_block);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        for(uint64_t block_idx = first_block; block_idx <= last_block; block_idx++) {
+            // position the streaming state at the block, as if the ones before it were decoded
+            uint64_t block_start = block_idx * header.block_size;
+            remaining_blocks = header.block_count - block_idx;
+            remaining_size = header.total_size - block_start;
+            uint64_t block_length = std::min(header.block_size, remaining_size);
+            // part of the block in the range
+            uint64_t range_start = std::max(offset, block_start);
+            uint64_t range_end = std::min(offset + length, block_start + block_length);
+            // whole blocks are decoded in place, partial ones through scratch
+            bool whole = range_start == block_start && range_end == block_start + block_length;
+            if(!whole) {
+                range_scratch.resize(block_length);
+            }
+            char* block_output = whole ? output + (block_start - offset) : range_scratch.data();
+            size_t consumed, block_written;
+            status = decodeBlock(input + block_offsets[block_idx], block_offsets[block_idx + 1] - block_offsets[block_idx], &consumed,
+                                 block_output, block_length, &block_written);
+            // the index says where the block ends, a block running past or short of it is corrupt
+            if(status == VALLI_ERROR_TRUNCATED || (status == VALLI_OK && consumed != block_offsets[block_idx + 1] - block_offsets[block_idx])) {
+                return VALLI_ERROR_CORRUPT;
+            }
+            if(status != VALLI_OK) {
+                return status;
+            }
+            if(!whole) {
+                memcpy(output + (range_start - offset), range_scratch.data() + (range_start - block_start), range_end - range_start);
+            }
+        }
+        *written = length;
+        return VALLI_OK;
+    }
+
+    // Occurrences of symbol (a byte, or a 16/32 bit value for wider symbols) in a whole container,
+    // read from the frequency tables alone, no block is decoded, except the ones that went through
+    // pipeline stages (VLI_FLAG_STAGES), whose tables count the transformed bytes.
+    // blocks_containing receives the number of blocks the symbol is in, when not null.
+    valli_status count(const unsigned char* input, size_t input_size, uint32_t symbol, uint64_t* occurrences, uint64_t* blocks_containing = nullptr) {
+        uint64_t blocks;
+        valli_status status = query(input, input_size, symbol, occurrences, &blocks, nullptr);
+        if(blocks_containing) {
+            *blocks_containing = blocks;
+        }
+        return status;
+    }
+
+    // Byte offsets of every occurrence of symbol in the decoded message, ascending, appended to positions.
+    // Blocks without the symbol are skipped after their frequency table.  In the others the encoded
+    // value is split only up to the symbol's own digit and only the symbols coded before it (the rarer
+    // ones) are placed to resolve its locations, the rest of the block is never decoded.  A block's
+    // most frequent symbol isn't coded, its locations are the ones left after all the others.
+    // Order 1 blocks (VLI_FLAG_CONTEXT) are decoded whole, the symbol can be in any context's stream,
+    // and so are blocks that went through pipeline stages.
+    valli_status locate(const unsigned char* input, size_t input_size, uint32_t symbol, std::vector<uint64_t>& positions) {
+        uint64_t occurrences, blocks;
+        return query(input, input_size, symbol, &occurrences, &blocks, &positions);
+    }
+
+  private:
+    // Per digit layout of a block shared by the decoding kernels, filled from the frequency table
+    struct BlockDigits {
+        // symbol, count, remaining locations and start of its locations in locs
+        std::vector<uint32_t> digit_symbol;
+        std::vector<uint64_t> digit_count_of;
+        std::vector<uint64_t> digit_remaining;
+        std::vector<size_t> digit_start;
+        // each instance's index among the remaining locations, instance order
+        std::vector<size_t> locs;
+        // bits of the total permutations, rounded up, from the frequency table
+        size_t max_bit_bound = 0;
+    };
+
+    ThreadPool pool;
+    // streaming state
+    uint64_t remaining_blocks = 0;
+    uint64_t remaining_size = 0;
+    // scratch kept between blocks and messages
+    BlockDigits digits;
+    // current block's encoded value, points into the caller's input
+    const unsigned char* payload = nullptr;
+    size_t payload_size = 0;
+    // wavelet mode: the tree, the symbol of each used entry and the locations on two levels
+    AlphabetTree tree;
+    std::vector<uint64_t> tree_counts;
+    std::vector<uint32_t> tree_symbols;
+    std::vector<size_t> tree_positions;
+    std::vector<size_t> tree_scratch;
+    // order 1 blocks: the tables and payloads of the context streams, the decoded streams and where
+    // each context's starts
+    struct ContextBlock {
+        uint8_t context;
+        FreqChar freqs;
+        const unsigned char* payload;
+        size_t payload_size;
+    };
+    std::vector<ContextBlock> context_blocks;
+    std::vector<uint8_t> context_streams;
+    std::array<uint64_t, CONTEXT_COUNT + 1> context_start;
+    // stages of the current block and their parameters, its coded length and its coded bytes
+    StagePipeline pipeline;
+    uint8_t block_stages = 0;
+    std::vector<uint64_t> stage_parameters;
+    uint64_t coded_length = 0;
+    std::vector<char> stage_block;
+    // a block decoded whole for a query
+    std::vector<char> whole_block;
+    // random access: where each block starts in the container, and a partially requested block
+    std::vector<uint64_t> block_offsets;
+    std::vector<char> range_scratch;
+
+    // count and locate: walk the blocks, locating only when positions is not null
+    valli_status query(const unsigned char* input, size_t input_size, uint32_t symbol, uint64_t* occurrences, uint64_t* blocks_containing, std::vector<uint64_t>* positions) {
+        *occurrences = 0;
+        *blocks_containing = 0;
+        size_t input_offset;
+        valli_status status = beginContainer(input, input_size, &input_offset);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        // the symbol must fit the container's symbols
+        if(header.symbol_bytes < 4 && symbol >> (8 * header.symbol_bytes)) {
+            return VALLI_ERROR_INVALID_ARGUMENT;
+        }
+        while(remaining_blocks > 0) {
+            size_t consumed;
+            if(header.symbol_bytes == 2) {
+                status = queryBlockAs<uint16_t>(input + input_offset, input_size - input_offset, &consumed, symbol, occurrences, blocks_containing, positions);
+            } else if(header.symbol_bytes == 4) {
+                status = queryBlockAs<uint32_t>(input + input_offset, input_size - input_offset, &consumed, symbol, occurrences, blocks_containing, positions);
+            } else {
+                status = queryBlockAs<uint8_t>(input + input_offset, input_size - input_offset, &consumed, symbol, occurrences, blocks_containing, positions);
+            }
+            if(status != VALLI_OK) {
+                return status;
+            }
+            input_offset += consumed;
+        }
+        return VALLI_OK;
+    }
+
+    // query for the next block, like decodeBlockAs without the output
+    template<typename Symbol>
+    valli_status queryBlockAs(const unsigned char* input, size_t input_size, size_t* consumed, uint32_t symbol, uint64_t* occurrences, uint64_t* blocks_containing, std::vector<uint64_t>* positions) {
+        FrequencyTable<Symbol> freqs;
+        uint8_t coding;
+        size_t block_bytes;
+        uint64_t block_length;
+        valli_status status = readBlockTable(input, input_size, freqs, &coding, &block_bytes, &block_length);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        if(coding == VLI_CODING_ORDER1 || block_stages) {
+            status = queryDecoded(freqs, coding, symbol, block_length, occurrences, blocks_containing, positions);
+            if(status != VALLI_OK) {
+                return status;
+            }
+            *consumed = block_bytes;
+            remaining_blocks--;
+            remaining_size -= block_length;
+            return VALLI_OK;
+        }
+        // the symbol's digit is the number of used entries before it, the table is in encoding order
+        uint64_t total_symbols = 0;
+        size_t unique_symbols = 0;
+        size_t symbol_digit = 0;
+        uint64_t symbol_count = 0;
+        for(size_t i = 0; i < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                if(freqs.getChar(i) == symbol) {
+                    symbol_digit = unique_symbols;
+                    symbol_count = freqs.getCount(i);
+                }
+                total_symbols += freqs.getCount(i);
+                unique_symbols++;
+            }
+        }
+        if(symbol_count) {
+            *occurrences += symbol_count;
+            (*blocks_containing)++;
+            if(positions) {
+                VALLI_TRACE_BLOCK_BEGIN(true);
+                uint64_t block_start = header.total_size - remaining_size;
+                if(!locateBlockValue(freqs, total_symbols, unique_symbols - 1, symbol_digit, block_start, *positions)) {
+                    return VALLI_ERROR_CORRUPT;
+                }
+                VALLI_TRACE_BLOCK_END();
+            }
+        }
+        *consumed = block_bytes;
+        remaining_blocks--;
+        remaining_size -= block_length;
+        return VALLI_OK;
+    }
+
+    // query for a block read by readBlockTable whose tables can't place the symbol: in an order 1
+    // block it can follow any context, the count is the sum over the context tables but its
+    // locations take decoding the whole block.  The tables of a staged block count transformed
+    // bytes, it is decoded whole even for the count.
+    template<typename Symbol>
+    valli_status queryDecoded(FrequencyTable<Symbol>& freqs, uint8_t coding, uint32_t symbol, uint64_t block_length, uint64_t* occurrences, uint64_t* blocks_containing, std::vector<uint64_t>* positions) {
+        if(!block_stages) {
+            uint64_t symbol_count = 0;
+            for(ContextBlock& stream : context_blocks) {
+                for(size_t i = 0; i < stream.freqs.size(); i++) {
+                    if(stream.freqs.getChar(i) == symbol) {
+                        symbol_count += stream.freqs.getCount(i);
+                    }
+                }
+            }
+            if(symbol_count == 0) {
+                return VALLI_OK;
+            }
+            if(!positions) {
+                *occurrences += symbol_count;
+                (*blocks_containing)++;
+                return VALLI_OK;
+            }
+        }
+        VALLI_TRACE_BLOCK_BEGIN(true);
+        whole_block.resize(block_length);
+        if(!decodeBlockData(freqs, coding, whole_block.data(), block_length)) {
+            return VALLI_ERROR_CORRUPT;
+        }
+        uint64_t block_start = header.total_size - remaining_size;
+        uint64_t symbol_count = 0;
+        for(uint64_t i = 0; i < block_length; i++) {
+            if((uint8_t)whole_block[i] == symbol) {
+                symbol_count++;
+                if(positions) {
+                    positions->push_back(block_start + i);
+                }
+            }
+        }
+        VALLI_TRACE_BLOCK_END();
+        if(symbol_count) {
+            *occurrences += symbol_count;
+            (*blocks_containing)++;
+        }
+        return VALLI_OK;
+    }
+
+    // Locations of the symbol at index target_digit among the block's used entries, its digit in
+    // symbol by symbol coding (digit_count for the uncoded last symbol), appended to positions as
+    // byte offsets from block_start
+    // returns false if the encoded value is too large for the frequency table
+    template<typename Symbol>
+    bool locateBlockValue(FrequencyTable<Symbol>& freqs, uint64_t total_symbols, size_t digit_count, size_t target_digit, uint64_t block_start, std::vector<uint64_t>& positions) {
+        if(header.flags & VLI_FLAG_WAVELET) {
+            // the tree's digits aren't in symbol order, the whole value is split and unranked,
+            // only the nodes on the path from the root to the symbol are walked
+            if(!layoutDigits(freqs, total_symbols, digit_count) || !unrankDigits(freqs, digit_count)) {
+                return false;
+            }
+            VALLI_TRACE_CLOCK(trace_clock);
+            tree.locate(digits.locs, digits.digit_start, total_symbols, target_digit, tree_positions, tree_scratch);
+            for(size_t loc : tree_positions) {
+                positions.push_back(block_start + loc * sizeof(Symbol));
+            }
+            VALLI_TRACE_LAP(trace_clock, TRACE_PLACE);
+            return true;
+        }
+        // every digit up to the target's, the earlier symbols' locations shift the target's
+        size_t digit_limit = std::min(target_digit + 1, digit_count);
+        if(!layoutDigits(freqs, total_symbols, digit_count) || !unrankDigits(freqs, digit_limit)) {
+            return false;
+        }
+        VALLI_TRACE_CLOCK(trace_clock);
+        // the same placement as decodeBlockValue, recording the target's locations instead of writing symbols
+        RemovedBitmap placed_locs;
+        placed_locs.reset(total_symbols);
+        for(size_t digit_idx = 0; digit_idx < digit_limit; digit_idx++) {
+            RemovedBitmap::Sweep remaining(placed_locs);
+            for(uint64_t symbol_count = 1; symbol_count <= digits.digit_count_of[digit_idx]; symbol_count++) {
+                size_t loc_idx = digits.locs[digits.digit_start[digit_idx] + symbol_count - 1];
+                size_t placed_idx = remaining.nthRemaining(loc_idx - (symbol_count - 1));
+                placed_locs.remove(placed_idx);
+                if(digit_idx == target_digit) {
+                    positions.push_back(block_start + placed_idx * sizeof(Symbol));
+                }
+            }
+        }
+        if(target_digit == digit_count) {
+            // the last symbol is wherever nothing was placed
+            for(size_t word = 0; word < placed_locs.words.size(); word++) {
+                for(uint64_t unplaced = ~placed_locs.words[word]; unplaced; unplaced &= unplaced - 1) {
+                    uint64_t loc = word * 64 + __builtin_ctzll(unplaced);
+                    if(loc >= total_symbols) {
+                        break;
+                    }
+                    positions.push_back(block_start + loc * sizeof(Symbol));
+                }
+            }
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_PLACE);
+        return true;
+    }
+
+    // Fill block_offsets up to the end of block last_block of a whole container, from the block
+    // index or else by skipping over the blocks
+    valli_status findBlocks(const unsigned char* input, size_t input_size, size_t header_bytes, uint64_t last_block) {
+        if(header.flags & VLI_FLAG_INDEX) {
+            return read_block_index(input, input_size, header, header_bytes, block_offsets) ? VALLI_OK : VALLI_ERROR_CORRUPT;
+        }
+        block_offsets.assign(1, header_bytes);
+        for(uint64_t block_idx = 0; block_idx <= last_block; block_idx++) {
+            ByteReader reader(input + block_offsets.back(), input_size - block_offsets.back());
+            bool read;
+            uint8_t coding;
+            try {
+                if(header.symbol_bytes == 2) {
+                    FrequencyTable<uint16_t> freqs;
+                    read = readTables(reader, freqs, coding);
+                } else if(header.symbol_bytes == 4) {
+                    FrequencyTable<uint32_t> freqs;
+                    read = readTables(reader, freqs, coding);
+                } else {
+                    FreqChar freqs;
+                    read = readTables(reader, freqs, coding);
+                }
+            } catch(const std::out_of_range&) {
+                return VALLI_ERROR_CORRUPT;
+            }
+            if(!read) {
+                return VALLI_ERROR_TRUNCATED;
+            }
+            block_offsets.push_back(block_offsets.back() + reader.position);
+        }
+        return VALLI_OK;
+    }
+
+    // Read the stages, coding, frequency tables and payloads of the next block: the stages into
+    // block_stages and stage_parameters, one table into freqs or, for an order 1 block, one per
+    // context stream into context_blocks
+    // returns false on a read error, throws out_of_range on a table or coding that can't be
+    template<typename Symbol>
+    bool readTables(ByteReader& reader, FrequencyTable<Symbol>& freqs, uint8_t& coding) {
+        block_stages = 0;
+        stage_parameters.clear();
+        if(header.flags & VLI_FLAG_STAGES) {
+            if(!reader.read((char*)&block_stages, 1)) {
+                return false;
+            }
+            if((block_stages & ~VLI_KNOWN_STAGES) || (block_stages && sizeof(Symbol) != 1)) {
+                throw std::out_of_range("unknown block stages");
+            }
+            for(size_t parameter_idx = 0; parameter_idx < StagePipeline::parameterCount(block_stages); parameter_idx++) {
+                uint64_t parameter;
+                if(!read_varint(reader, parameter)) {
+                    return false;
+                }
+                stage_parameters.push_back(parameter);
+            }
+        }
+        coding = VLI_CODING_ORDER0;
+        if((header.flags & VLI_FLAG_CONTEXT) && !reader.read((char*)&coding, 1)) {
+            return false;
+        }
+        if(coding == VLI_CODING_ORDER0) {
+            return read_block(reader, freqs, payload, payload_size);
+        }
+        if(coding != VLI_CODING_ORDER1 || sizeof(Symbol) != 1) {
+            throw std::out_of_range("unknown block coding");
+        }
+        uint64_t stream_count;
+        if(!read_varint(reader, stream_count)) {
+            return false;
+        }
+        if(stream_count == 0 || stream_count > CONTEXT_COUNT) {
+            throw std::out_of_range("context count");
+        }
+        context_blocks.resize(stream_count);
+        for(size_t stream_idx = 0; stream_idx < stream_count; stream_idx++) {
+            ContextBlock& stream = context_blocks[stream_idx];
+            stream.freqs = FreqChar();
+            if(!reader.read((char*)&stream.context, 1)) {
+                return false;
+            }
+            // ascending, every context once
+            if(stream_idx > 0 && stream.context <= context_blocks[stream_idx - 1].context) {
+                throw std::out_of_range("context order");
+            }
+            if(!read_block(reader, stream.freqs, stream.payload, stream.payload_size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Read the tables of the next block (readTables), block_bytes receives its size in the
+    // container and block_length its decoded size in bytes, checked against the header, and
+    // coded_length the size of the coded bytes (before undoing the block's stages)
+    template<typename Symbol>
+    valli_status readBlockTable(const unsigned char* input, size_t input_size, FrequencyTable<Symbol>& freqs, uint8_t* coding, size_t* block_bytes, uint64_t* block_length) {
+        VALLI_TRACE_CLOCK(trace_clock);
+        ByteReader reader(input, input_size);
+        try {
+            if(!readTables(reader, freqs, *coding)) {
+                return VALLI_ERROR_TRUNCATED;
+            }
+        } catch(const std::out_of_range&) {
+            // the table's symbol list doesn't match its counts, or the block's coding is unknown
+            return VALLI_ERROR_CORRUPT;
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_TABLE);
+        *block_length = 0;
+        size_t payload_bytes = payload_size;
+        if(*coding == VLI_CODING_ORDER1) {
+            payload_bytes = 0;
+            for(ContextBlock& stream : context_blocks) {
+                payload_bytes += stream.payload_size;
+                for(size_t i = 0; i < stream.freqs.size(); i++) {
+                    *block_length += stream.freqs.getCount(i);
+                }
+            }
+        }
+        VALLI_TRACE_BLOCK_SET(payload_bytes, payload_bytes);
+        if(log) {
+            if(header.flags & VLI_FLAG_STAGES) {
+                *log << "Stages: " << StagePipeline::names(block_stages) << std::endl;
+            }
+            if(header.flags & VLI_FLAG_CONTEXT) {
+                *log << "Coding: " << (*coding == VLI_CODING_ORDER1 ? "order 1, " + std::to_string(context_blocks.size()) + " contexts" : std::string("order 0")) << std::endl;
+            }
+            *log << "Encoding size (bytes): " << payload_bytes << std::endl;
+        }
+        for(size_t i = 0; i < freqs.size(); i++) {
+            *block_length += freqs.getCount(i);
+        }
+        // in bytes, the counts are symbols
+        *block_length *= sizeof(Symbol);
+        coded_length = *block_length;
+        // every block but the last is full, the stages can change the length within bounds
+        uint64_t expected_length = std::min(header.block_size, remaining_size);
+        if(block_stages ? coded_length > StagePipeline::maxStagedSize(expected_length) : coded_length != expected_length) {
+            return VALLI_ERROR_CORRUPT;
+        }
+        *block_length = expected_length;
+        *block_bytes = reader.position;
+        return VALLI_OK;
+    }
+
+    // decodeBlock for Symbol sized symbols
+    template<typename Symbol>
+    valli_status decodeBlockAs(const unsigned char* input, size_t input_size, size_t* consumed, char* output, size_t capacity, size_t* written) {
+        VALLI_TRACE_BLOCK_BEGIN(true);
+        FrequencyTable<Symbol> freqs;
+        uint8_t coding;
+        size_t block_bytes;
+        uint64_t block_length;
+        valli_status status = readBlockTable(input, input_size, freqs, &coding, &block_bytes, &block_length);
+        if(status != VALLI_OK) {
+            return status;
+        }
+        *written = block_length;
+        if(block_length > capacity) {
+            return VALLI_ERROR_OUTPUT_TOO_SMALL;
+        }
+        if(!decodeBlockData(freqs, coding, output, block_length)) {
+            return VALLI_ERROR_CORRUPT;
+        }
+        VALLI_TRACE_BLOCK_END();
+        *consumed = block_bytes;
+        remaining_blocks--;
+        remaining_size -= block_length;
+        return VALLI_OK;
+    }
+
+    // Decode the block readBlockTable read into output, block_length bytes: its encoded value or
+    // context streams, then back through its stages
+    // returns false if the block's values or stages don't fit its tables and length
+    template<typename Symbol>
+    bool decodeBlockData(FrequencyTable<Symbol>& freqs, uint8_t coding, char* output, uint64_t block_length) {
+        // staged blocks are decoded into scratch, then transformed back into output
+        char* coded_output = output;
+        if(block_stages) {
+            stage_block.resize(coded_length);
+            coded_output = stage_block.data();
+        }
+        if(coding == VLI_CODING_ORDER1 ? !decodeContexts(coded_output, coded_length) : !decodeBlockValue(freqs, coded_output)) {
+            return false;
+        }
+        if(block_stages) {
+            VALLI_TRACE_CLOCK(trace_clock);
+            bool undone = pipeline.inverse(block_stages, (const uint8_t*)stage_block.data(), coded_length, stage_parameters, (uint8_t*)output, block_length);
+            VALLI_TRACE_LAP(trace_clock, TRACE_STAGES);
+            return undone;
+        }
+        return true;
+    }
+
+    // Order 1: decode every context stream readTables read, then walk the block to merge them
+    // returns false if a stream's value is too large for its table or the streams don't fit the block
+    bool decodeContexts(char* output, uint64_t block_length) {
+        context_start.fill(0);
+        for(ContextBlock& stream : context_blocks) {
+            for(size_t i = 0; i < stream.freqs.size(); i++) {
+                context_start[stream.context + 1] += stream.freqs.getCount(i);
+            }
+        }
+        for(size_t c = 0; c < CONTEXT_COUNT; c++) {
+            context_start[c + 1] += context_start[c];
+        }
+        context_streams.resize(block_length);
+        for(ContextBlock& stream : context_blocks) {
+            if(log) {
+                *log << "------ Context " << (uint)stream.context << " ------" << std::endl;
+            }
+            payload = stream.payload;
+            payload_size = stream.payload_size;
+            if(!decodeBlockValue(stream.freqs, (char*)context_streams.data() + context_start[stream.context])) {
+                return false;
+            }
+        }
+        VALLI_TRACE_CLOCK(trace_clock);
+        bool merged = context_merge(context_streams.data(), context_start, (uint8_t*)output, block_length);
+        VALLI_TRACE_LAP(trace_clock, TRACE_PLACE);
+        return merged;
+    }
+
+    // Fill digits from the frequency table, one digit per symbol but the last in encoding order,
+    // or per node of the alphabet partition tree in wavelet mode (the same number of digits)
+    // returns false if the payload is too long for the table
+    template<typename Symbol>
+    bool layoutDigits(FrequencyTable<Symbol>& freqs, uint64_t total_symbols, size_t digit_count) {
+        digits.max_bit_bound = (size_t)(permutation_bits(freqs) + 1e-6) + 1;
+        VALLI_TRACE_BLOCK_SET(max_bits, digits.max_bit_bound);
+        if(header.flags & VLI_FLAG_WAVELET) {
+            layoutTree(freqs);
+        } else {
+            layoutSymbols(freqs, total_symbols, digit_count);
+        }
+        // the value is below the total permutations, so it can't have more bytes than that
+        return payload_size <= digits.max_bit_bound / 8 + 1;
+    }
+
+    template<typename Symbol>
+    void layoutSymbols(FrequencyTable<Symbol>& freqs, uint64_t total_symbols, size_t digit_count) {
+        uint64_t remaining_locations = total_symbols;
+        digits.digit_symbol.resize(digit_count);
+        digits.digit_count_of.resize(digit_count);
+        digits.digit_remaining.resize(digit_count);
+        digits.digit_start.resize(digit_count);
+        size_t digit_idx = 0;
+        for(size_t i = 0; i + 1 < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                digits.digit_symbol[digit_idx] = freqs.getChar(i);
+                digits.digit_count_of[digit_idx] = freqs.getCount(i);
+                digits.digit_remaining[digit_idx] = remaining_locations;
+                digits.digit_start[digit_idx] = total_symbols - remaining_locations;
+                VALLI_TRACE_SYMBOL(freqs.getChar(i), freqs.getCount(i), remaining_locations, binomial_bit_bound(remaining_locations, freqs.getCount(i)));
+                remaining_locations -= freqs.getCount(i);
+                digit_idx++;
+            }
+        }
+        digits.locs.resize(total_symbols - remaining_locations);
+    }
+
+    template<typename Symbol>
+    void layoutTree(FrequencyTable<Symbol>& freqs) {
+        tree_counts.clear();
+        tree_symbols.clear();
+        for(size_t i = 0; i < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                tree_counts.push_back(freqs.getCount(i));
+                tree_symbols.push_back(freqs.getChar(i));
+            }
+        }
+        tree.build(tree_counts);
+        size_t node_count = tree.nodes.size();
+        digits.digit_count_of.resize(node_count);
+        digits.digit_remaining.resize(node_count);
+        digits.digit_start.resize(node_count);
+        uint64_t instances = 0;
+        for(size_t node_idx = 0; node_idx < node_count; node_idx++) {
+            AlphabetTree::Node& node = tree.nodes[node_idx];
+            digits.digit_start[node_idx] = instances;
+            digits.digit_count_of[node_idx] = node.left_locations;
+            digits.digit_remaining[node_idx] = node.locations;
+            VALLI_TRACE_SYMBOL(node_idx, node.left_locations, node.locations, binomial_bit_bound(node.locations, node.left_locations));
+            instances += node.left_locations;
+        }
+        digits.locs.resize(instances);
+    }
+
+    // Split the encoded value into digits and unrank the first digit_limit of them into digits.locs
+    // Blocks whose total permutations fit in a machine word skip GMP entirely,
+    // the encoder picked the word size from the same frequency table
+    // returns false if the encoded value is too large for the frequency table
+    template<typename Symbol>
+    bool unrankDigits(FrequencyTable<Symbol>& freqs, size_t digit_limit) {
+        int word_bits = native_word_bits(freqs);
+        int native_decoded = -1;
+        if(word_bits == 64) {
+            native_decoded = decodeDigitsNative<uint64_t>(digit_limit);
+        } else if(word_bits == 128) {
+            native_decoded = decodeDigitsNative<unsigned __int128>(digit_limit);
+        }
+        if(native_decoded == 0) {
+            return false;
+        }
+        if(native_decoded < 0 && !decodeDigitsGmp(digit_limit)) {
+            return false;
+        }
+        VALLI_TRACE_BLOCK_SET(kernel_bits, native_decoded > 0 ? word_bits : 0);
+        if(log) {
+            *log << "Kernel: " << (native_decoded > 0 ? std::to_string(word_bits) + " bit" : std::string("GMP")) << std::endl;
+        }
+        return true;
+    }
+
+    // Decode a single block into output, freqs is the block's deserialized frequency table
+    // and payload the bytes of its encoded value, symbols are unranked on the pool's threads
+    // returns false if the encoded value is too large for the frequency table
+    template<typename Symbol>
+    bool decodeBlockValue(FrequencyTable<Symbol>& freqs, char* output) {
+        if(log) {
+            *log << "Frequencies:" << std::endl;
+            *log << (sizeof(Symbol) == 1 ? "int : char : count" : "int : count") << std::endl;
+        }
+        uint64_t total_symbols = 0;
+        uint64_t unique_symbols = 0;
+        for (size_t i = 0; i < freqs.size(); i++) {
+            if(freqs.getCount(i)) {
+                if(log) {
+                    *log << (uint)freqs.getChar(i) << " : ";
+                    if(sizeof(Symbol) == 1) {
+                        *log << (char)freqs.getChar(i) << " : ";
+                    }
+                    *log << freqs.getCount(i) << std::endl;
+                }
+                total_symbols += freqs.getCount(i);
+                unique_symbols++;
+            }
+        }
+        VALLI_TRACE_BLOCK_SET(length, total_symbols);
+        VALLI_TRACE_BLOCK_SET(unique_symbols, unique_symbols);
+
+        // This implementation fills the output message buffer with the last symbol,
+        // after all other symbols are placed correctly the
+        // last symbol is already in the correct locations.
+        Symbol last_symbol = freqs.getChar(freqs.size()-1);
+        // fill the decoded output with most common character
+        if(sizeof(Symbol) == 1) {
+            std::fill(output, output + total_symbols, (char)last_symbol);
+        } else {
+            for(size_t i = 0; i < total_symbols; i++) {
+                store_symbol(output, i, last_symbol);
+            }
+        }
+        // To extract each symbol's combination from the encoded value, it is split into digits
+        // of a mixed radix number, the radix of each encoded symbol is the number of ways
+        // to place it: remaining locations choose symbol count.
+        // The radices only depend on the frequency table, so the split is done up front with
+        // a remainder tree instead of one full size division per symbol.
+        // The last symbol isn't encoded, so there is one digit less than unique symbols.
+        size_t digit_count = unique_symbols-1;
+        if(!layoutDigits(freqs, total_symbols, digit_count) || !unrankDigits(freqs, digit_count)) {
+            return false;
+        }
+
+        VALLI_TRACE_CLOCK(trace_clock);
+        if(header.flags & VLI_FLAG_WAVELET) {
+            // every node splits its locations between its halves, down to a symbol's locations
+            tree.place(digits.locs, digits.digit_start, total_symbols, tree_positions, tree_scratch,
+                       [&](size_t entry, const size_t* locations, uint64_t count) {
+                Symbol symbol = tree_symbols[entry];
+                for(uint64_t i = 0; i < count; i++) {
+                    store_symbol(output, locations[i], symbol);
+                }
+            });
+            VALLI_TRACE_LAP(trace_clock, TRACE_PLACE);
+            return true;
+        }
+        // Placed locations, the j-th remaining location is found with a popcount sweep over the bitmap
+        // instead of scanning the output buffer for locations still holding the last symbol,
+        // the output is never compared so any symbol can be the last.
+        RemovedBitmap placed_locs;
+        placed_locs.reset(total_symbols);
+        // Loop through each symbol, except the last, in encoding order and place its instances
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            Symbol current_symbol = digits.digit_symbol[digit_idx];
+            // verbose output
+            VALLI_TRACE_DETAIL(if(log) {
+                *log << "------------------------------------" << std::endl;
+                *log << "Current symbol: " << (char)current_symbol << " (" << (uint)current_symbol << ")" << std::endl;
+                *log << "Locations remaining: " << digits.digit_remaining[digit_idx] << std::endl;
+            })
+
+            // smallest index location placed first, sweeping the bitmap once
+            RemovedBitmap::Sweep remaining(placed_locs);
+            for(uint64_t symbol_count = 1; symbol_count <= digits.digit_count_of[digit_idx]; symbol_count++) {
+                // zero based index among the remaining locations
+                size_t loc_idx = digits.locs[digits.digit_start[digit_idx] + symbol_count - 1];
+
+                // The indexes count the symbol's own locations as remaining, each one placed before
+                // is below this one and already removed, so the index among what is left is
+                // loc_idx - (symbol_count-1), which never decreases and keeps the sweep moving forward.
+                size_t placed_idx = remaining.nthRemaining(loc_idx - (symbol_count - 1));
+                placed_locs.remove(placed_idx);
+                //update character in output buffer
+                store_symbol(output, placed_idx, current_symbol);
+                // verbose output
+                VALLI_TRACE_DETAIL(if(log) {
+                    *log << "Location: " << loc_idx << " choose " << symbol_count << std::endl;
+                    *log << "Symbol placed at: " << placed_idx << std::endl;
+                })
+            }
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_PLACE);
+        return true;
+    }
+
+    // GMP kernel: splits the encoded value with a remainder tree and unranks on the pool's threads
+    // only the first digit_limit digits, the others are neither computed nor unranked
+    // returns false if the value is not below the total permutations
+    bool decodeDigitsGmp(size_t digit_limit) {
+        VALLI_TRACE_CLOCK(trace_clock);
+        size_t digit_count = digit_limit;
+        MpzArray symbol_digits(digit_count);
+        MpzArray symbol_radices(digit_count);
+        // every value's size is known up front from its radix, size them once instead of growing
+        std::vector<size_t> radix_bits(digit_count);
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            radix_bits[digit_idx] = binomial_bit_bound(digits.digit_remaining[digit_idx], digits.digit_count_of[digit_idx]);
+            mpz_realloc2(symbol_digits[digit_idx], radix_bits[digit_idx]);
+            mpz_realloc2(symbol_radices[digit_idx], radix_bits[digit_idx]);
+        }
+        // sieve the primes the binomial engine needs for this block before the tasks share it
+        binomial_engine().prepare(digits.digit_count_of.empty() ? 0 : digits.digit_remaining[0]);
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            pool.submit([&, digit_idx] {
+                binomial_engine().binomial(symbol_radices[digit_idx], digits.digit_remaining[digit_idx], digits.digit_count_of[digit_idx]);
+            });
+        }
+        pool.wait();
+        ProductTree uncombiner;
+        uncombiner.build(symbol_radices);
+        VALLI_TRACE_LAP(trace_clock, TRACE_RADICES);
+        // imported once the radices are done, a task throwing through wait() can't leak it
+        mpz_t compressed_data;
+        mpz_init2(compressed_data, digits.max_bit_bound);
+        mpz_from_payload(payload, payload_size, compressed_data);
+        VALLI_TRACE_LAP(trace_clock, TRACE_IMPORT);
+        VALLI_TRACE_BLOCK_SET(value_bits, mpz_sizeinbase(compressed_data, 2));
+        // verbose info
+        VALLI_TRACE_DETAIL(if(log) {
+            *log << "Imported Integer: " << mpz_string(compressed_data) << std::endl;
+        })
+        if(digit_count < digits.digit_count_of.size()) {
+            // the lowest digits are the value modulo the product of their radices, one division
+            // by a number the size of those digits instead of splitting the whole value
+            mpz_tdiv_r(compressed_data, compressed_data, uncombiner.total());
+        } else if(mpz_cmp(compressed_data, uncombiner.total()) >= 0) {
+            // a value that large would unrank to locations outside the block
+            mpz_clear(compressed_data);
+            return false;
+        }
+        uncombiner.split(compressed_data, symbol_digits);
+        mpz_clear(compressed_data);
+        VALLI_TRACE_LAP(trace_clock, TRACE_SPLIT);
+        VALLI_TRACE_DETAIL(if(log) {
+            for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+                *log << "Radix: " << mpz_string(symbol_radices[digit_idx]) << " " << std::endl;
+            }
+        })
+
+        // Once split, each symbol's combination unranks independently of the others,
+        // only turning "index among the remaining locations" into an absolute location needs
+        // the earlier symbols, that is deferred to the sequential pass in decodeBlockValue.
+        for(size_t digit_idx = 0; digit_idx < digit_count; digit_idx++) {
+            pool.submit([&, digit_idx] {
+                VALLI_TRACE_CLOCK(task_clock);
+                // recovers the symbol's locations from its sum of binomials, largest location first
+                CombinationUnranker unranker(radix_bits[digit_idx]);
+                unranker.reset(digits.digit_remaining[digit_idx]);
+                for(uint64_t symbol_count = digits.digit_count_of[digit_idx]; symbol_count > 0; symbol_count--) {
+                    digits.locs[digits.digit_start[digit_idx] + symbol_count - 1] = unranker.next(symbol_digits[digit_idx], symbol_count);
+                }
+                VALLI_TRACE_SYMBOL_LAP(task_clock, digit_idx);
+            });
+        }
+        pool.wait();
+        VALLI_TRACE_LAP(trace_clock, TRACE_UNRANK);
+        return true;
+    }
+
+    // Native kernel for blocks whose total permutations fit in a Word, same locations as the GMP kernel
+    // the whole value is split (a few word divisions), only the first digit_limit digits are unranked
+    // returns 1 when decoded, 0 if the value is not below the total permutations,
+    // -1 if a value turns out not to fit, the caller falls back to GMP
+    template<typename Word>
+    int decodeDigitsNative(size_t digit_limit) {
+        typedef NativeKernel<Word> Kernel;
+        VALLI_TRACE_CLOCK(trace_clock);
+        Word compressed_data;
+        std::vector<Word> symbol_radices;
+        Word total;
+        if(!Kernel::fromPayload(payload, payload_size, compressed_data) || !Kernel::radices(digits.digit_remaining, digits.digit_count_of, symbol_radices, total)) {
+            return -1;
+        }
+        if(compressed_data >= total) {
+            return 0;
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_RADICES);
+        VALLI_TRACE_BLOCK_SET(value_bits, Kernel::bitLength(compressed_data));
+        // verbose info
+        VALLI_TRACE_DETAIL(if(log) {
+            *log << "Imported Integer: " << Kernel::toString(compressed_data) << std::endl;
+        })
+
+        std::vector<Word> symbol_digits;
+        Kernel::split(compressed_data, symbol_radices, symbol_digits);
+        VALLI_TRACE_LAP(trace_clock, TRACE_SPLIT);
+        VALLI_TRACE_CLOCK(symbol_clock);
+        for(size_t digit_idx = 0; digit_idx < digit_limit; digit_idx++) {
+            VALLI_TRACE_DETAIL(if(log) {
+                *log << "Radix: " << Kernel::toString(symbol_radices[digit_idx]) << " " << std::endl;
+            })
+            Kernel::unrank(symbol_digits[digit_idx], digits.digit_count_of[digit_idx], digits.digit_remaining[digit_idx], &digits.locs[digits.digit_start[digit_idx]]);
+            VALLI_TRACE_SYMBOL_LAP(symbol_clock, digit_idx);
+        }
+        VALLI_TRACE_LAP(trace_clock, TRACE_UNRANK);
+        return 1;
+    }
+};